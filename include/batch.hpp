@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <chip8.hpp>
+
+//Runs many copies of one ROM in lockstep, one lane per copy
+//CPU state lives here as structure-of-arrays, one contiguous run of lanes per field,
+//so common opcodes execute for every lane at the same pc with one vector kernel.
+//Memory, stack and display stay in a Chip8 per lane, and anything the kernels
+//don't cover is stepped on that Chip8 with the scalar interpreter.
+class Chip8Batch {
+
+public:
+    explicit Chip8Batch(size_t lanes);
+
+    bool LoadROM(const std::filesystem::path& filepath);
+    //Every lane becomes a copy of machine, keeping its own CXNN state and the batch's quirks.
+    //The memory it holds is the code all lanes share until one of them writes. Lanes are not traced.
+    void LoadMachine(const Chip8& machine);
+    void SeedRandom(uint32_t seed); //Lane N gets seed + N, so CXNN differs per lane
+    void SetQuirks(QuirkProfile profile); //Every lane, kept across LoadROM
+    void Run(uint64_t cycles);
+    void TickTimers();
+    void SetKey(size_t lane, uint8_t key, bool down)
+        {keypad[key * stride + lane] = down;}
+    void SetRegister(size_t lane, uint8_t reg, uint8_t value)
+        {V[(reg & 0xF) * stride + lane] = value;}
+
+    size_t Lanes() const
+        {return lanes;}
+    //Copies the lane's CPU state back into its Chip8 and returns it
+    const Chip8& Lane(size_t lane);
+
+    uint64_t LaneInstructions() const
+        {return laneInstructions;}
+    uint64_t VectorLaneInstructions() const
+        {return vectorLaneInstructions;}
+
+private:
+    void Step();
+    void StepScalar(size_t lane);
+    bool StepVector(const Instruction& in, const uint8_t* mask);
+    void Gather(size_t lane);  //Chip8 -> lane arrays
+    void Scatter(size_t lane); //Lane arrays -> Chip8
+
+    size_t lanes;
+    size_t stride; //Lanes rounded up to the widest vector
+    std::vector<Chip8> machines;
+
+    std::vector<uint8_t> V;      //16 * stride, register-major
+    std::vector<uint8_t> keypad; //16 * stride, key-major
+    std::vector<uint16_t> pc;
+    std::vector<uint16_t> I;
+    std::vector<uint16_t> opcode;
+    std::vector<uint8_t> sp;
+    std::vector<uint8_t> delayTimer;
+    std::vector<uint8_t> soundTimer;
+    std::vector<uint64_t> executed; //Chip8::Cycles() per lane, vector steps count here
+
+    std::vector<uint8_t> active;    //0xFF for real lanes, 0 for padding
+    std::vector<uint8_t> remaining; //Lanes not yet stepped this cycle
+    std::vector<uint8_t> group;     //Lanes stepped by the current kernel
+    std::vector<uint8_t> condition; //Per-lane skip results
+    std::vector<uint8_t> memoryWritten; //Lane stored to memory, so its code may differ
+    bool anyMemoryWritten = false;
+    QuirkProfile quirks = QuirkProfile::Chip8;
+    bool shiftVx = false; //Shift kernels read VX instead of VY
+
+    uint64_t laneInstructions = 0;
+    uint64_t vectorLaneInstructions = 0;
+};
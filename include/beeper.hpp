@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <spsc_queue.hpp>
+
+//Square wave beeper driven by sound timer on/off transitions
+//The emulation thread calls SetTone() on every transition, which stamps it with the host clock and queues it.
+//The audio callback calls Render(), which plays each transition a fixed two buffers after it was stamped,
+//so transitions keep their spacing instead of snapping to buffer boundaries.
+//Neither side blocks, locks or allocates; transitions are dropped if the queue is ever full.
+class Beeper {
+
+public:
+    Beeper(int sampleRate, int bufferFrames, double frequency = 440.0, float volume = 0.15f);
+
+    void SetTone(bool on); //Emulation thread
+    void Render(float* out, size_t frames); //Audio thread
+
+private:
+    struct Transition {
+        int64_t time; //steady_clock nanoseconds
+        bool on;
+    };
+
+    SpscQueue<Transition, 256> queue;
+
+    //Audio thread state
+    Transition next{};
+    bool hasNext = false;
+    bool gate = false;
+    float level = 0.0f; //Ramps toward volume or 0 to avoid clicks
+    double phase = 0.0;
+
+    double increment; //Cycles per sample
+    int64_t latency;  //Nanoseconds, two buffers
+    double sampleRate;
+    float volume;
+    float ramp;       //Level change per sample
+};
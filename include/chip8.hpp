@@ -2,24 +2,154 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <decode.hpp>
+#include <jit.hpp>
+#include <quirks.hpp>
+#include <trace_ring.hpp>
+#ifdef CHIP8_PROFILE
+#include <profile.hpp>
+#endif
+
+#define ON_COLOR 0xDC143CFF //True Crimson
+#define OFF_COLOR 0x1E1E1EFF //Graphite Grey
+
+enum class Engine : uint8_t {
+    Switch, //Reference interpreter, nested switch decode on every cycle
+    Table,  //Decode table lookup with threaded dispatch
+    Cached, //Per-address cache of decoded instructions, filled on first execution
+    Jit     //x86-64 basic-block recompiler, runs as Cached on other hosts
+};
+
+//Heap state derived from the machine (caches, generated code) that a copy rebuilds instead of sharing
+template<typename T>
+class DerivedState {
+
+public:
+    DerivedState() = default;
+    DerivedState(const DerivedState&) {}
+    DerivedState& operator=(const DerivedState&)
+        {state.reset(); return *this;}
+    T& Get()
+        {if (!state) state = std::make_unique<T>(); return *state;}
+    T* Peek() const
+        {return state.get();}
+
+private:
+    std::unique_ptr<T> state;
+};
+
+class RomImage;
+
+struct DecodeCache {
+    Instruction entries[4096]; //Zeroed entries are Op::Decode
+};
 
 class Chip8 {
 
+    friend class Chip8Batch;
+    friend class ForkNode;
+
 public:
     void Initialize();
-    void LoadROM(const std::filesystem::path& filepath);
+    bool LoadROM(const std::filesystem::path& filepath); //Through RomCache::Shared(), false if unreadable or too large
+    void LoadImage(const RomImage& image); //Stamps the whole 4 KB image, call after Initialize()
+    static void CopyFontset(uint8_t* memory); //Writes the fontset at 0x50
     void EmulateCycle();
+    void Run(uint64_t cycles);
+    uint64_t Cycles() const //Instructions run since construction, idle-skipped ones included
+        {return executed;}
     void TickTimers();
-    uint32_t gfx[64 * 32];
+    bool SoundActive() const
+        {return soundTimer > 0;}
+    uint64_t DisplayHash() const;
+
+    //Versioned snapshot of everything but the keypad, host byte order
+    static constexpr size_t STATE_SIZE = 4424;
+    size_t SaveState(uint8_t* buffer, size_t size) const; //Returns bytes written, 0 if the buffer is too small
+    bool LoadState(const uint8_t* buffer, size_t size);
+    bool SaveStateFile(const std::filesystem::path& filepath) const;
+    bool LoadStateFile(const std::filesystem::path& filepath);
+    bool GetPixel(int x, int y) const
+        {return (gfx[y & 31] >> (63 - (x & 63))) & 1;}
+    //64 colors per row, row-major, starting at firstRow
+    void ExpandDisplay(uint32_t* out, uint32_t onColor, uint32_t offColor, int firstRow = 0, int rowCount = 32) const;
+    //Same for a copy of gfx, such as a frame handed to another thread
+    static void ExpandRows(const uint64_t* rows, uint32_t* out, uint32_t onColor, uint32_t offColor, int firstRow = 0, int rowCount = 32);
+    void ExpandDisplay(uint8_t* out) const; //64*32 bytes of 0 or 1
+    void SeedRandom(uint32_t seed);
+    void SetEngine(Engine selected)
+        {engine = selected;}
+    Engine GetEngine() const
+        {return engine;}
+    void SetQuirks(QuirkProfile profile); //Drops code compiled for the previous profile
+    QuirkProfile GetQuirks() const
+        {return quirks;}
+    //Appends every executed instruction to ring, null to stop. Traced runs interpret every instruction:
+    //switch and table run as table, cached and jit as cached. The ring a call replaces gets its
+    //newest record's register value filled in.
+    void SetTrace(TraceRing* ring);
+    uint64_t gfx[32]{}; //One row per word, bit 63 is column 0
     uint8_t keypad[16]{};
+    //Bumped by every 00E0 and every DXYN that flips a pixel
+    uint64_t DisplayGeneration() const
+        {return displayGeneration;}
+    //Rows changed since the last call, bit N is row N
+    uint32_t TakeDirtyRows()
+        {uint32_t rows = dirtyRows; dirtyRows = 0; return rows;}
+    //Set when the last Run() ended in an idle loop (1NNN to itself, a delay timer poll or an FX0A wait)
+    //Nothing changes until the next TickTimers() or keypad change
+    bool IsIdle() const
+        {return idle;}
+    //Idle with both timers at zero, so only a keypad change can wake it
+    bool IsIdleUntilKey() const
+        {return idle && delayTimer == 0 && soundTimer == 0;}
     uint8_t* GetMemory() 
         {return memory;}
+    void InvalidateCode(uint16_t address, uint16_t length); //Call after writing memory through GetMemory()
+#ifdef CHIP8_PROFILE
+    Profile& GetProfile()
+        {return profile;}
+#endif
     bool waitingForKey = false;
     uint8_t waitingRegister = 0;
     int8_t pressedKey = -1; 
 
 
 private:
+    template<typename Quirks> void RunEngine(uint64_t cycles);
+    template<typename Quirks> void StepReference();
+    template<bool Cached, typename Quirks, bool Traced = false> void RunInterpreter(uint64_t cycles);
+    template<typename Quirks> void RunJit(uint64_t cycles);
+    template<typename Quirks> void Draw(uint8_t x, uint8_t y, uint8_t height); //DXYN with x and y the register indices
+    template<typename Quirks> static void JitStep(Chip8* self);
+    template<typename Quirks> static void JitDraw(Chip8* self, uint32_t x, uint32_t y, uint32_t height);
+    static void JitInvalidate(Chip8* self, uint32_t address, uint32_t length);
+    static void JitClear(Chip8* self);
+    template<typename Quirks> JitLayout Layout() const;
+    uint8_t NextRandom();
+    unsigned IdleLoopLength(uint16_t target) const;
+    void MarkDisplayDirty(uint32_t rows)
+        {dirtyRows |= rows; ++displayGeneration;}
+
+    Engine engine = Engine::Table;
+    QuirkProfile quirks = QuirkProfile::Chip8;
+    TraceRing* trace = nullptr;
+    uint32_t rngState = 0x2545F491; //xorshift32 state for CXNN
+    DerivedState<DecodeCache> decodeCache;
+    DerivedState<JitCache> jit;
+    uint64_t displayGeneration = 0;
+    bool idle = false;
+    uint64_t executed = 0;
+    uint64_t jitBudget = 0; //Instructions left to compiled blocks during RunJit
+    uint32_t dirtyRows = 0;
+    uint16_t writtenChunks = 0xFFFF; //256 byte memory chunks written since the last ForkNode restore
+#ifdef CHIP8_PROFILE
+    Profile profile;
+#endif
+
+    //Nothing a ROM does indexes past these arrays: fetches and memory[I + n] wrap at 4 KB, sp wraps
+    //around the 16-entry stack and EX9E/EXA1 use the low nibble of VX, the same in every engine
     uint16_t pc{};
     uint16_t opcode{};
     uint16_t I{}; 
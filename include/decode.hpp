@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//Every operation the interpreter knows, in handler-table order
+#define CHIP8_OPS(X) \
+    X(Decode)   /* Empty decode cache slot, must stay first so zeroed slots decode */ \
+    X(Nop)      /* Unknown opcode, skip it */ \
+    X(Stall)    /* Unknown FX__ opcode, pc is left alone */ \
+    X(Cls)      /* 00E0 */ \
+    X(Ret)      /* 00EE */ \
+    X(Jp)       /* 1NNN */ \
+    X(Call)     /* 2NNN */ \
+    X(SeImm)    /* 3XNN */ \
+    X(SneImm)   /* 4XNN */ \
+    X(SeReg)    /* 5XY0 */ \
+    X(LdImm)    /* 6XNN */ \
+    X(AddImm)   /* 7XNN */ \
+    X(LdReg)    /* 8XY0 */ \
+    X(Or)       /* 8XY1 */ \
+    X(And)      /* 8XY2 */ \
+    X(Xor)      /* 8XY3 */ \
+    X(AddReg)   /* 8XY4 */ \
+    X(Sub)      /* 8XY5 */ \
+    X(Shr)      /* 8XY6 */ \
+    X(Subn)     /* 8XY7 */ \
+    X(Shl)      /* 8XYE */ \
+    X(SneReg)   /* 9XY0 */ \
+    X(LdI)      /* ANNN */ \
+    X(JpV0)     /* BNNN */ \
+    X(Rnd)      /* CXNN */ \
+    X(Drw)      /* DXYN */ \
+    X(Skp)      /* EX9E */ \
+    X(Sknp)     /* EXA1 */ \
+    X(LdVxDt)   /* FX07 */ \
+    X(LdVxK)    /* FX0A */ \
+    X(LdDtVx)   /* FX15 */ \
+    X(LdStVx)   /* FX18 */ \
+    X(AddIVx)   /* FX1E */ \
+    X(LdFVx)    /* FX29 */ \
+    X(LdBVx)    /* FX33 */ \
+    X(StoreRegs)/* FX55 */ \
+    X(LoadRegs) /* FX65 */
+
+enum class Op : uint8_t {
+#define CHIP8_OP_ENUM(name) name,
+    CHIP8_OPS(CHIP8_OP_ENUM)
+#undef CHIP8_OP_ENUM
+    Count
+};
+
+//An opcode with its operands already pulled out
+struct Instruction {
+    Op op;
+    uint8_t x;       //Second nibble
+    uint8_t y;       //Third nibble
+    uint8_t nn;      //Low byte, the last nibble is nn & 0xF
+    uint16_t nnn;    //Low 12 bits
+    uint16_t opcode; //Raw opcode
+};
+
+Instruction DecodeOpcode(uint16_t opcode);
+const char* OpName(Op op); //Enum name, "Count" for out of range values
+std::string Disassemble(uint16_t opcode); //Cowgod-style mnemonic such as "DRW V0, V1, 5", unknown opcodes as "DW 0xNNNN"
+
+//Registers an instruction writes, for the tracer: the lowest in the low nibble, plus WRITES_MORE when
+//it writes others too (the VF flag of 8XY4-8XYE, V1-VX of FX65), or WRITES_NONE
+constexpr uint8_t WRITES_NONE = 0xFF;
+constexpr uint8_t WRITES_MORE = 0x10;
+inline uint8_t WrittenRegisters(const Instruction& in)
+{
+    enum : uint8_t {None, Vx, VxVf, Vf, V0ToVx};
+    static constexpr uint8_t kinds[] = {
+        None, None, None, None, None, None, None, None, None, None, //Decode-SeReg
+        Vx, Vx, Vx, Vx, Vx, Vx,                                     //LdImm-Xor
+        VxVf, VxVf, VxVf, VxVf, VxVf,                               //AddReg-Shl
+        None, None, None, Vx, Vf, None, None,                       //SneReg-Sknp
+        Vx, Vx, None, None, None, None, None, None, V0ToVx          //LdVxDt-LoadRegs
+    };
+    static_assert(sizeof(kinds) == static_cast<size_t>(Op::Count), "One kind per Op");
+
+    //Selects rather than a switch, the kind is as unpredictable as the ROM
+    uint8_t kind = kinds[static_cast<uint8_t>(in.op)];
+    uint8_t more = (kind == VxVf && in.x != 0xF) || (kind == V0ToVx && in.x != 0) ? WRITES_MORE : 0;
+    uint8_t lowest = kind == Vf ? 0xF : kind == V0ToVx ? 0 : in.x;
+    return kind == None ? WRITES_NONE : static_cast<uint8_t>(lowest | more);
+}
+
+//65536 entries, one per raw opcode, built on first use
+const Instruction* DecodeTable();
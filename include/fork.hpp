@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <chip8.hpp>
+
+//Snapshot of a running machine for tree search, sharing memory copy-on-write
+//Memory is held as 16 immutable 256 byte chunks. A child forked from a node keeps the node's
+//chunks and only allocates the ones the machine wrote (FX33, FX55, GetMemory) since it was restored,
+//so a node costs its CPU state and display plus the chunks that actually changed.
+//Nodes are immutable and can be restored from any number of threads at once.
+class ForkNode {
+
+public:
+    static constexpr size_t CHUNK_SIZE = 256;
+    static constexpr size_t CHUNKS = 4096 / CHUNK_SIZE;
+
+    explicit ForkNode(const Chip8& machine); //Full capture, for the root of a tree
+
+    //Capture a machine last restored from this node, sharing every chunk it has not written since
+    ForkNode Fork(const Chip8& machine) const;
+    void Restore(Chip8& machine) const;
+    //Restore into a machine last restored from loaded, copying only the chunks that differ
+    void Restore(Chip8& machine, const ForkNode& loaded) const;
+
+    size_t SharedChunks(const ForkNode& other) const;
+
+private:
+    using Chunk = std::array<uint8_t, CHUNK_SIZE>;
+
+    ForkNode() = default;
+    void CaptureCpu(const Chip8& machine);
+    void RestoreCpu(Chip8& machine) const;
+    void RestoreChunk(Chip8& machine, size_t chunk) const;
+
+    std::shared_ptr<const Chunk> chunks[CHUNKS];
+    uint64_t gfx[32];
+    uint16_t stack[16];
+    uint8_t registers[16];
+    uint8_t keypad[16];
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;
+    uint8_t sp;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    bool waitingForKey;
+    uint8_t waitingRegister;
+    int8_t pressedKey;
+    uint32_t rngState;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+#include <spsc_queue.hpp>
+
+//Records displayed frames to disk on a background writer thread
+//Submit() only copies the packed 256 byte framebuffer into a preallocated ring, all pixel expansion,
+//encoding and file I/O happen on the writer. When the ring is full the frame is dropped and counted,
+//so memory stays bounded and the emulation thread never waits on the disk.
+//The format follows the extension: .y4m is 60 fps YUV 4:4:4 video, .rgba is headerless RGBA8888
+//frames, .png writes a numbered sequence next to the given name (name_000000.png, ...) with a
+//two-color 1-bit palette.
+class FrameCapture {
+
+public:
+    FrameCapture(uint32_t onColor, uint32_t offColor, int scale = 1); //Colors are RGBA8888
+    ~FrameCapture();
+
+    bool Open(const std::filesystem::path& filepath); //Starts the writer, false if the output can't be created
+    void Submit(const uint64_t* rows); //32 rows laid out as Chip8::gfx, one producer thread only
+    bool Close(); //Writes the queued frames and stops the writer, false if a write failed
+
+    //Producer side counts, Written() is exact once Close() returned
+    uint64_t Submitted() const
+        {return submitted;}
+    uint64_t Dropped() const
+        {return dropped;}
+    uint64_t Written() const
+        {return written.load(std::memory_order_relaxed);}
+
+private:
+    enum class Format : uint8_t {Y4m, Raw, Png};
+    using Frame = std::array<uint64_t, 32>;
+
+    void WriterLoop();
+    bool WriteFrame(const Frame& frame);
+    void ExpandIndices(const Frame& frame); //One byte per scaled pixel, 1 for on
+    bool WritePng();
+
+    static constexpr size_t CAPACITY = 256; //About 4 seconds at 60 fps, 64 KB
+
+    SpscQueue<Frame, CAPACITY> queue;
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> written{0};
+    bool failed = false;  //Writer only until joined
+    uint64_t submitted = 0;
+    uint64_t dropped = 0;
+
+    Format format = Format::Raw;
+    std::filesystem::path path;
+    std::ofstream file; //Y4M and raw output
+    uint32_t onColor;
+    uint32_t offColor;
+    uint8_t yuv[2][3]; //Off and on colors as BT.601 studio range Y, Cb, Cr
+    int scale;
+    int width;
+    int height;
+
+    //Writer scratch, sized once in Open()
+    std::vector<uint8_t> indices;
+    std::vector<uint8_t> zlib;   //PNG image data
+    std::vector<uint8_t> output; //Bytes of one frame or file
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <chip8.hpp>
+
+//Wire format of the frame server, host byte order since both ends share a machine
+//A client sends 8 byte requests. Key takes no reply. Step N answers with N updates, one per frame,
+//Run N with a single update after the last frame, and Sync with an update right away. Every update
+//is a 16 byte header and a payload in the requested format. Delta payloads hold one 8 byte word per set
+//bit of rowMask, lowest row first: that row XOR the one the client already has. Rows and Rgba send the
+//whole frame, as Chip8::gfx or as 64*32 ON_COLOR/OFF_COLOR pixels.
+namespace FrameProtocol {
+
+enum class Command : uint8_t {Key = 1, Step, Run, Sync, Quit};
+enum class Format : uint8_t {Delta, Rows, Rgba};
+
+struct Request {
+    Command command;
+    uint8_t key;     //Key: keypad index
+    uint8_t down;    //Key: nonzero presses it
+    Format format;   //Step, Run and Sync
+    uint32_t frames; //Step and Run
+};
+static_assert(sizeof(Request) == 8, "Request is sent as is");
+
+struct Update {
+    static constexpr uint8_t SOUND = 1;          //flags: the sound timer is running
+    static constexpr uint8_t IDLE_UNTIL_KEY = 2; //flags: nothing changes until a key event
+
+    uint64_t frame;     //Frames run since the server started
+    uint32_t rowMask;   //Rows in a delta payload, all 32 for Rows and Rgba
+    uint16_t payloadBytes;
+    Format format;
+    uint8_t flags;
+};
+static_assert(sizeof(Update) == 16, "Update is sent as is");
+
+constexpr size_t MAX_PAYLOAD = 64 * 32 * 4;
+
+}
+
+//Runs one machine for controllers connecting over a Unix domain socket, one client at a time
+//A frame is instructionsPerFrame instructions and a timer tick. The server keeps a copy of the
+//display the client was last sent, so deltas stay correct across batched runs and format changes,
+//and starts it blank for every new connection. Updates are encoded into a buffer allocated once
+//and written with a single send each. Serve() returns when a client sends Quit; a client hanging
+//up just frees the socket for the next one. POSIX only, Listen() fails elsewhere.
+class FrameServer {
+
+public:
+    FrameServer(Chip8& machine, uint64_t instructionsPerFrame);
+    ~FrameServer();
+    FrameServer(const FrameServer&) = delete;
+    FrameServer& operator=(const FrameServer&) = delete;
+
+    bool Listen(const std::filesystem::path& socketPath); //Replaces a stale socket file at the path
+    bool Serve(); //False on a socket error
+    void Close();
+
+    uint64_t Frames() const
+        {return frame;}
+    uint64_t Requests() const
+        {return requests;}
+    uint64_t BytesSent() const
+        {return bytesSent;}
+
+private:
+    bool Handle(int client, const FrameProtocol::Request& request, bool& quit);
+    bool SendUpdate(int client, FrameProtocol::Format format);
+
+    Chip8& machine;
+    uint64_t instructionsPerFrame;
+    int listener = -1;
+    std::filesystem::path path;
+    uint64_t sent[32]{}; //The display as the client has it
+    uint64_t frame = 0;
+    uint64_t requests = 0;
+    uint64_t bytesSent = 0;
+    alignas(8) uint8_t message[sizeof(FrameProtocol::Update) + FrameProtocol::MAX_PAYLOAD];
+};
+
+//Controller side of one connection, keeps the client's copy of the display up to date
+class FrameClient {
+
+public:
+    FrameClient() = default;
+    ~FrameClient();
+    FrameClient(const FrameClient&) = delete;
+    FrameClient& operator=(const FrameClient&) = delete;
+
+    bool Connect(const std::filesystem::path& socketPath);
+    void Close();
+
+    bool Key(uint8_t key, bool down);
+    bool Step(uint32_t frames, FrameProtocol::Format format = FrameProtocol::Format::Delta); //Reads every update
+    bool Run(uint32_t frames, FrameProtocol::Format format = FrameProtocol::Format::Delta);  //Reads the final one
+    bool Sync(FrameProtocol::Format format = FrameProtocol::Format::Rows); //Full display, whatever the format
+    bool Quit();
+
+    const uint64_t* Rows() const //Laid out as Chip8::gfx
+        {return rows;}
+    const FrameProtocol::Update& LastUpdate() const
+        {return last;}
+    uint64_t BytesReceived() const
+        {return bytesReceived;}
+
+private:
+    bool Send(const FrameProtocol::Request& request);
+    bool ReceiveUpdate();
+
+    int fd = -1;
+    uint64_t rows[32]{};
+    FrameProtocol::Update last{};
+    uint64_t bytesReceived = 0;
+    alignas(8) uint8_t payload[FrameProtocol::MAX_PAYLOAD];
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <chip8.hpp>
+#include <movie.hpp>
+#include <spsc_queue.hpp>
+
+//Keypad changes from an input thread, applied to the machine at the guest cycle matching their host time
+//Run() spreads the host time since its previous call over the cycles it runs, so events keep their spacing
+//at a fixed one frame of latency. A release is held back until the key has been down for
+//minimumHoldCycles, so a tap shorter than one guest poll is still seen by EX9E and FX0A.
+class InputQueue {
+
+public:
+    explicit InputQueue(uint64_t minimumHoldCycles);
+
+    static int64_t Now(); //steady_clock nanoseconds, the time base for Push
+    void Push(uint8_t key, bool down, int64_t time); //Input thread, dropped if the queue is full
+    void Push(uint8_t key, bool down)
+        {Push(key, down, Now());}
+
+    void Run(Chip8& machine, uint64_t cycles); //Emulation thread
+    //Emulation thread: events not applied yet, such as a release held back for the minimum hold.
+    //The machine still has to run for them even if it is idle until a key changes
+    bool HasPending() const
+        {return hasNext || !queue.Empty();}
+    void SetRecorder(InputMovie* movie) //Every applied change goes to movie->RecordKeys(), null to stop
+        {recorder = movie;}
+
+private:
+    struct Event {
+        int64_t time;
+        uint8_t key;
+        bool down;
+    };
+
+    uint64_t Schedule(const Event& event, uint64_t firstCycle, uint64_t cycles, int64_t windowStart, int64_t windowEnd) const;
+
+    SpscQueue<Event, 256> queue;
+
+    //Emulation thread state
+    uint64_t minimumHold;
+    Event next{};
+    bool hasNext = false;
+    uint64_t nextCycle = 0;
+    uint64_t lastCycle = 0;      //Events are applied in order, never before the previous one
+    uint64_t pressCycle[16]{};
+    int64_t lastRun = 0;
+    InputMovie* recorder = nullptr;
+};
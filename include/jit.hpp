@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+class Chip8;
+
+//Byte offsets of guest state inside a Chip8, baked into generated code as displacements
+struct JitLayout {
+    void (*step)(Chip8*); //Interprets the instruction at pc, for opcodes without native code
+    void (*draw)(Chip8*, uint32_t x, uint32_t y, uint32_t height); //DXYN, x and y name registers
+    void (*invalidate)(Chip8*, uint32_t address, uint32_t length); //After a store to guest memory
+    void (*clear)(Chip8*); //00E0
+    int32_t memory;
+    int32_t registers;
+    int32_t stack;
+    int32_t keypad;
+    int32_t pc;
+    int32_t opcode;
+    int32_t I;
+    int32_t sp;
+    int32_t delayTimer;
+    int32_t soundTimer;
+    int32_t budget;  //uint64_t instructions left in the run, each block takes its length off before it starts
+    bool shiftVx;    //8XY6/8XYE quirk, fixed when a block is translated
+    bool incrementI; //FX55/FX65 quirk, likewise
+};
+
+//Translates straight-line CHIP-8 basic blocks into x86-64 code
+//Blocks end at 1NNN, 2NNN, 00EE, BNNN, skips and memory stores, or before FX0A and unknown FX opcodes
+//A block that ends jumps straight into the block at the new pc when one is compiled and the budget covers it,
+//and returns to the caller otherwise, leaving pc at the block it didn't enter
+class JitCache {
+
+public:
+    using BlockFn = void (*)(Chip8*);
+
+    struct Block {
+        BlockFn fn;      //nullptr when the instruction at this address must be interpreted
+        BlockFn chain;   //fn when other blocks may jump straight here, nullptr for idle loop jumps the caller must see
+        uint16_t length; //Guest instructions executed by one call
+        uint8_t state;   //Empty, Compiled or Interpret
+        uint8_t pad;
+        uint16_t end;    //One past the last memory byte translated
+    };
+
+    JitCache();
+    ~JitCache();
+    JitCache(const JitCache&) = delete;
+    JitCache& operator=(const JitCache&) = delete;
+
+    //False on hosts without x86-64 or when executable memory is unavailable
+    bool Available() const
+        {return arena != nullptr;}
+
+    const Block& Lookup(uint16_t address, const uint8_t* memory, const JitLayout& layout)
+    {
+        Block& block = blocks[address & 0xFFF];
+        if (block.state == Empty)
+            Compile(address & 0xFFF, memory, layout);
+        return block;
+    }
+
+    void Invalidate(uint16_t address, uint16_t length);
+    void Flush();
+
+private:
+    enum : uint8_t { Empty, Compiled, Interpret };
+
+    void Compile(uint16_t address, const uint8_t* memory, const JitLayout& layout);
+    void Finish(Block& block, uint16_t address, uint16_t end, int length, size_t codeSize);
+    void Drop(uint16_t address);
+
+    uint8_t* arena = nullptr;
+    size_t arenaUsed = 0;
+    Block blocks[4096]{};
+    uint8_t covered[4096]{};   //Number of compiled blocks and interpreter markers read from each memory byte
+    uint16_t compiled[4096]{}; //Start addresses of compiled blocks
+    size_t compiledCount = 0;
+};
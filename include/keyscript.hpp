@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+//A key press or release that lands at the start of a given frame
+struct KeyEvent {
+    uint64_t frame;
+    uint8_t key;
+    bool down;
+};
+
+//Scripted keypad for runs without a window
+//Script format, one event per line: <frame> <key 0-F> <down|up>, '#' starts a comment
+class KeyScript {
+
+public:
+    bool Load(const std::filesystem::path& filepath);
+    void Apply(uint64_t frame, uint8_t* keypad);
+    void Rewind() 
+        {next = 0;}
+    bool Empty() const
+        {return events.empty();}
+
+private:
+    std::vector<KeyEvent> events;
+    size_t next = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <chip8.hpp>
+
+//A recorded play session that replays bit for bit through Chip8, no window or host clock involved
+//Holds the ROM hash, the CXNN seed, the quirk profile, the instructions per frame, every keypad change at the guest cycle
+//it was applied and the DisplayHash() after every frame, so a replay can name the first frame that differs.
+//On disk keypad changes are varint cycle deltas with the changed key bits, and runs of equal frame
+//hashes are stored once, so a still screen costs a few bytes per run rather than per frame.
+class InputMovie {
+
+public:
+    static constexpr uint64_t MAX_FRAMES = uint64_t(1) << 24; //About three days at 60 Hz, 128 MB of hashes once loaded
+
+    //Recording, call Start() once the ROM is loaded and seeded with the same seed
+    void Start(const Chip8& machine, uint64_t romHash, uint32_t seed, uint32_t instructionsPerFrame);
+    void RecordKeys(const Chip8& machine); //After any keypad change, keeps it if the keys differ
+    void RecordFrame(const Chip8& machine); //After each frame's TickTimers()
+
+    //Seeds the machine, which must hold the freshly loaded ROM, sets its quirks and runs every frame at full speed
+    //False at the first frame whose display hash differs from the recording, reported in divergedFrame
+    bool Replay(Chip8& machine, uint64_t& divergedFrame) const;
+
+    bool Save(const std::filesystem::path& filepath) const; //False past MAX_FRAMES, Load() would refuse the file
+    bool Load(const std::filesystem::path& filepath); //False if unreadable, not a movie or longer than MAX_FRAMES
+
+    uint64_t RomHash() const
+        {return romHash;}
+    uint32_t Seed() const
+        {return seed;}
+    QuirkProfile Quirks() const
+        {return quirks;}
+    uint32_t InstructionsPerFrame() const
+        {return instructionsPerFrame;}
+    uint64_t Frames() const
+        {return frameHashes.size();}
+    size_t KeyChanges() const
+        {return events.size();}
+
+private:
+    struct Event {
+        uint64_t cycle; //Guest cycles since Start()
+        uint16_t keys;  //Whole keypad after the change, bit N is key N
+    };
+
+    static uint16_t KeyMask(const Chip8& machine);
+    static void SetKeys(Chip8& machine, uint16_t keys);
+
+    uint64_t romHash = 0;
+    uint32_t seed = 0;
+    QuirkProfile quirks = QuirkProfile::Chip8;
+    uint32_t instructionsPerFrame = 0;
+    uint16_t initialKeys = 0;
+    std::vector<Event> events;
+    std::vector<uint64_t> frameHashes;
+
+    //Recording state
+    uint64_t startCycle = 0;
+    uint16_t lastKeys = 0;
+};
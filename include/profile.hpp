@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <decode.hpp>
+
+//Guest-side profile filled by the interpreters when the core is built with CHIP8_PROFILE
+//Counts every executed instruction by op, by address and by call path, the path being the chain
+//of 2NNN targets that led to it, so the folded output renders as a flame graph of guest subroutines.
+class Profile {
+
+public:
+    Profile();
+
+    void Record(uint16_t pc, uint16_t opcode, uint8_t sp)
+    {
+        const Instruction& in = DecodeTable()[opcode];
+        ++instructions;
+        ++pcHits[pc & 0xFFF];
+        ++depthHits[sp < 16 ? sp : 16];
+
+        //Loading a state or resetting can drop frames under us, follow sp back up
+        while (frames[current].depth > sp)
+            current = frames[current].parent;
+
+        ++frames[current].ops[static_cast<uint8_t>(in.op)];
+        if (in.op == Op::Call)
+            current = Enter(in.nnn, sp + 1);
+        else if (in.op == Op::Ret && current != 0)
+            current = frames[current].parent;
+    }
+    void RecordDraw(unsigned x, unsigned y, unsigned height, bool collided)
+    {
+        ++draws;
+        collisions += collided;
+        wraps += (x & 63) + 8 > 64 || (y & 31) + height > 32;
+    }
+    void Reset();
+
+    bool WriteJson(const std::filesystem::path& filepath) const;
+    bool WriteFolded(const std::filesystem::path& filepath) const; //"main;sub_2a0;Drw 1234" lines
+    bool Write(const std::filesystem::path& filepath) const; //Folded for .folded, JSON otherwise
+
+private:
+    struct Frame {
+        uint16_t entry;    //2NNN target, 0x200 for the root
+        uint8_t depth;     //sp inside this frame
+        uint32_t parent;
+        uint32_t child;    //First callee
+        uint32_t sibling;  //Next callee of the parent
+        uint64_t ops[static_cast<uint8_t>(Op::Count)];
+    };
+
+    uint32_t Enter(uint16_t entry, uint8_t depth);
+
+    uint64_t instructions = 0;
+    uint64_t pcHits[4096]{};
+    uint64_t depthHits[17]{}; //Instructions run at each sp
+    uint64_t draws = 0;
+    uint64_t collisions = 0;
+    uint64_t wraps = 0;
+    std::vector<Frame> frames; //Call tree, frames[0] is the root
+    uint32_t current = 0;
+};
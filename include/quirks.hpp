@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+//Behaviors that differ between CHIP-8 implementations, picked per ROM
+enum class QuirkProfile : uint8_t {
+    Chip8,  //This emulator's original rules: shifts read VY, FX55/FX65 keep I, sprites wrap, BNNN adds V0
+    Vip,    //COSMAC VIP: shifts read VY, FX55/FX65 advance I, sprites clip, BNNN adds V0
+    Chip48, //HP-48 CHIP-48: shifts VX in place, FX55/FX65 advance I, sprites clip, BXNN adds VX
+    Schip   //SUPER-CHIP 1.1: shifts VX in place, FX55/FX65 keep I, sprites clip, BXNN adds VX
+};
+
+//Compile-time flags of one profile, the interpreters are instantiated once per policy
+//so a quirk is resolved when the handler is compiled, not on every instruction
+template<bool ShiftVx, bool IncrementI, bool ClipSprites, bool JumpVx>
+struct QuirkPolicy {
+    static constexpr bool shiftVx = ShiftVx;         //8XY6/8XYE shift VX in place instead of storing VY shifted
+    static constexpr bool incrementI = IncrementI;   //FX55/FX65 leave I at I + X + 1
+    static constexpr bool clipSprites = ClipSprites; //DXYN drops pixels past the right and bottom edges instead of wrapping
+    static constexpr bool jumpVx = JumpVx;           //BXNN jumps to XNN + VX instead of NNN + V0
+};
+
+using Chip8Quirks = QuirkPolicy<false, false, false, false>;
+using VipQuirks = QuirkPolicy<false, true, true, false>;
+using Chip48Quirks = QuirkPolicy<true, true, true, true>;
+using SchipQuirks = QuirkPolicy<true, false, true, true>;
+
+//Calls fn with the policy of profile, the one switch that selects an instantiation
+template<typename Fn>
+decltype(auto) WithQuirks(QuirkProfile profile, Fn&& fn)
+{
+    switch (profile)
+    {
+        case QuirkProfile::Vip:
+            return fn(VipQuirks{});
+        case QuirkProfile::Chip48:
+            return fn(Chip48Quirks{});
+        case QuirkProfile::Schip:
+            return fn(SchipQuirks{});
+        default:
+            return fn(Chip8Quirks{});
+    }
+}
+
+bool ParseQuirkProfile(const std::string& name, QuirkProfile& profile); //chip8, vip, chip48 or schip
+const char* QuirkProfileName(QuirkProfile profile);
+
+//Profiles for known ROMs, looked up by content hash or by file name
+//File format, one ROM per line: <RomImage::Hash() in hex, or a file name> <profile>, '#' starts a comment
+class QuirkDatabase {
+
+public:
+    bool Load(const std::filesystem::path& filepath);
+    //False when the ROM isn't listed, a hash entry wins over a name entry
+    bool Find(uint64_t romHash, const std::filesystem::path& romPath, QuirkProfile& profile) const;
+
+private:
+    std::unordered_map<uint64_t, QuirkProfile> byHash;
+    std::unordered_map<std::string, QuirkProfile> byName;
+};
+
+//Profile for a ROM from the quirks.txt beside it, Chip8 when there is no database or no entry
+QuirkProfile LookupQuirks(const std::filesystem::path& romPath, uint64_t romHash);
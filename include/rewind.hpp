@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <chip8.hpp>
+
+//History of per-frame save states inside a fixed byte budget
+//Every keyframeInterval frames a full state is stored, frames in between are stored as the XOR
+//against that keyframe with zero runs collapsed, so only changed bytes of memory and gfx take space.
+//All buffers are allocated up front, Push and Pop never allocate. The oldest frames are dropped first.
+class RewindBuffer {
+
+public:
+    explicit RewindBuffer(size_t budgetBytes, uint32_t keyframeInterval = 60);
+
+    void Push(const Chip8& chip8);
+    bool Pop(Chip8& chip8); //Restores the newest frame and removes it, false when empty
+    void Clear();
+
+    size_t Frames() const
+        {return count;}
+    size_t BytesUsed() const
+        {return bytesUsed;}
+
+private:
+    struct Record {
+        size_t offset;  //Budgets can pass 4 GB
+        uint32_t size;  //One encoded state, at most a few KB
+        bool keyframe;
+    };
+
+    Record& At(size_t age) //0 is the oldest record
+        {return records[(first + age) % records.size()];}
+    size_t NewestKeyframe(); //Age of the newest keyframe, count if there is none
+    size_t Reserve(size_t size);
+    void EvictOldest();
+
+    std::vector<uint8_t> ring;
+    std::vector<Record> records;
+    size_t first = 0;
+    size_t count = 0;
+    size_t head = 0; //Next write offset in ring
+    size_t bytesUsed = 0;
+    uint32_t interval;
+
+    std::vector<uint8_t> current;  //Scratch save state
+    std::vector<uint8_t> keyframe; //Decoded state of keyframeAge
+    std::vector<uint8_t> encoded;  //Scratch encoding, worst case size
+    size_t keyframeAge = SIZE_MAX; //Which record keyframe holds, SIZE_MAX for none
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//A ROM ready to stamp into a machine: the full 4 KB memory image with the fontset at 0x50
+//and the program at 0x200, built once per distinct file content
+class RomImage {
+
+public:
+    static constexpr size_t MAX_ROM_SIZE = 4096 - 0x200;
+
+    const uint8_t* Memory() const
+        {return memory;}
+    size_t Size() const //Program bytes
+        {return size;}
+    uint64_t Hash() const //FNV-1a of the program bytes
+        {return hash;}
+
+private:
+    friend class RomCache;
+
+    uint8_t memory[4096]{};
+    size_t size = 0;
+    uint64_t hash = 0;
+};
+
+//Process-wide cache of RomImages, keyed by path and by content hash
+//Each file is memory-mapped once to build its image; a path is read again only when its size or
+//modification time changes, and identical files under different paths share one image. Thread-safe.
+class RomCache {
+
+public:
+    static RomCache& Shared();
+
+    //Null and a message on std::cerr if the file can't be read or is larger than MAX_ROM_SIZE
+    std::shared_ptr<const RomImage> Load(const std::filesystem::path& filepath);
+    void Clear();
+
+private:
+    struct PathEntry {
+        std::shared_ptr<const RomImage> image;
+        std::filesystem::file_time_type modified;
+        uintmax_t size;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, PathEntry> byPath;
+    std::unordered_map<uint64_t, std::shared_ptr<const RomImage>> byHash;
+};
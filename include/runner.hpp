@@ -0,0 +1,27 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+
+//Frame structure shared by the windowless tools: a batch of instructions, then a timer tick
+//applyKeys(frame) runs before each frame; returns the number of completed frames
+template<typename Machine, typename ApplyKeys>
+uint64_t RunFrames(Machine& machine, uint64_t cycleBudget, uint64_t instructionsPerFrame, ApplyKeys applyKeys)
+{
+    uint64_t cycles = 0;
+    uint64_t frames = 0;
+
+    while (cycles < cycleBudget) {
+        applyKeys(frames);
+
+        uint64_t batch = std::min(instructionsPerFrame, cycleBudget - cycles);
+        machine.Run(batch);
+        cycles += batch;
+
+        if (batch == instructionsPerFrame) {
+            machine.TickTimers();
+            ++frames;
+        }
+    }
+    return frames;
+}
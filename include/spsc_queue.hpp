@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+//Bounded single-producer single-consumer queue, wait-free on both ends
+//Storage is inline, so neither side ever allocates. Capacity must be a power of two.
+template<typename T, size_t Capacity>
+class SpscQueue {
+
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool TryPush(const T& value) //Producer only, false when full
+    {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        slots[tail & (Capacity - 1)] = value;
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    bool TryPop(T& value) //Consumer only, false when empty
+    {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire))
+            return false;
+        value = slots[head & (Capacity - 1)];
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    bool Empty() const //Consumer only, a racing push may land right after
+        {return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);}
+
+private:
+    //Each index on its own cache line so the two threads don't share one
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    alignas(64) T slots[Capacity];
+};
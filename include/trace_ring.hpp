@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <decode.hpp>
+
+//One executed instruction, 16 bytes so a ring of them is a flat array the dump writes as is
+struct TraceRecord {
+    static constexpr uint8_t NO_REGISTER = 0xFF;
+    static constexpr uint8_t MANY_REGISTERS = 1; //flags: it writes more than the one in reg
+
+    uint32_t cycle;     //Low 32 bits of Chip8::Cycles() for this instruction
+    uint16_t pc;
+    uint16_t opcode;
+    uint16_t I;         //Before the instruction ran
+    uint8_t sp;
+    uint8_t reg;        //Lowest register the instruction writes, NO_REGISTER if none
+    uint8_t value;      //Its value afterwards
+    uint8_t flags;
+    uint8_t delayTimer;
+    uint8_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is written to disk as is");
+
+//File layout: this header, then count records oldest first, host byte order
+struct TraceFileHeader {
+    char magic[4];     //"C8TR"
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t count;    //Records in the file
+    uint32_t reserved;
+    uint64_t total;    //Records appended over the run, total - count were overwritten
+};
+
+//Preallocated ring of the most recent instructions, appended by the emulation thread
+//Append() is a handful of stores with no locks or allocation. The written register's value is only known
+//once the instruction ran, so it is filled in at the next Append(), and for the newest record by Detach()
+//or, while a machine is attached, read from its registers as the dump is written.
+//Dumps are plain write(2) calls on the ring memory, safe from a signal handler; a dump taken while the
+//emulation thread runs may catch the record being written half done.
+class TraceRing {
+
+public:
+    explicit TraceRing(size_t capacity = 1 << 16); //Rounded up to a power of two
+    ~TraceRing();
+    TraceRing(const TraceRing&) = delete;
+    TraceRing& operator=(const TraceRing&) = delete;
+
+    //written is WrittenRegisters() of the instruction, its value is read at the next Append()
+    void Append(uint32_t cycle, uint16_t pc, uint16_t opcode, uint16_t I, uint8_t sp, uint8_t delayTimer,
+                uint8_t written, const uint8_t* registers)
+    {
+        uint64_t index = head.load(std::memory_order_relaxed);
+
+        //Before the first record and after Detach() this lands in spare, no record waits for a value
+        *pendingValue = registers[lastWritten & 0xF];
+        pendingValue = &records[index & mask].value;
+        lastWritten = written;
+
+        uint8_t reg = written == WRITES_NONE ? TraceRecord::NO_REGISTER : written & 0xF;
+        uint8_t flags = written != WRITES_NONE && (written & WRITES_MORE) ? TraceRecord::MANY_REGISTERS : 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        records[index & mask] = {cycle, pc, opcode, I, sp, reg, 0, flags, delayTimer, 0};
+#else
+        //Two word stores instead of ten field stores, in TraceRecord's field order
+        uint64_t words[2] = {
+            cycle | static_cast<uint64_t>(pc) << 32 | static_cast<uint64_t>(opcode) << 48,
+            I | static_cast<uint64_t>(sp) << 16 | static_cast<uint64_t>(reg) << 24 | static_cast<uint64_t>(flags) << 40 |
+                static_cast<uint64_t>(delayTimer) << 48
+        };
+        std::memcpy(&records[index & mask], words, sizeof(words));
+#endif
+        head.store(index + 1, std::memory_order_release);
+    }
+
+    uint64_t Total() const
+        {return head.load(std::memory_order_acquire);}
+    size_t Capacity() const
+        {return mask + 1;}
+    void Clear();
+
+    //Chip8::SetTrace() calls these. Dumps read the attached registers for the newest record's value,
+    //Detach() writes it into the record for good.
+    void Attach(const uint8_t* registers)
+        {machineRegisters = registers;}
+    void Detach();
+
+    bool Dump(const std::filesystem::path& filepath) const; //False if the file can't be written or off POSIX
+    bool DumpTo(int fd) const; //Async-signal-safe
+
+    //Dumps this ring to filepath on SIGUSR1 and keeps running, and on a crash signal before the
+    //default action. One ring at a time, a later call replaces the earlier one. False where unsupported.
+    bool InstallSignalHandlers(const std::filesystem::path& filepath);
+    void RemoveSignalHandlers();
+
+private:
+    std::unique_ptr<TraceRecord[]> records;
+    uint64_t mask;
+    std::atomic<uint64_t> head{0};
+    uint8_t lastWritten = WRITES_NONE;
+    uint8_t spare = 0;
+    uint8_t* pendingValue = &spare; //Value of the newest record, still to be filled in
+    const uint8_t* machineRegisters = nullptr;
+    char dumpPath[4096]{}; //Copied in for the signal handler, which can't touch std::filesystem
+};
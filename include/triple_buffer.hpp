@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+//Lock-free handoff of the latest value from one writer thread to one reader thread
+//The writer fills its back slot and publishes it, the reader takes the newest published slot.
+//Neither side ever waits, the reader never sees a half-written value and skipped values are dropped.
+template<typename T>
+class TripleBuffer {
+
+public:
+    T& WriteBuffer() //Writer only
+        {return slots[back].value;}
+    void Publish() //Writer only
+        {back = shared.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;}
+
+    //Reader only, true if a newer value was published since the last call
+    bool Read()
+    {
+        if (!(shared.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        front = shared.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& ReadBuffer() const //Reader only
+        {return slots[front].value;}
+
+private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t FRESH = 4;
+
+    struct alignas(64) Slot {
+        T value{};
+    };
+
+    Slot slots[3];
+    std::atomic<uint8_t> shared{1}; //Middle slot index, FRESH once published and not yet read
+    uint8_t back = 0;  //Writer's slot
+    uint8_t front = 2; //Reader's slot
+};
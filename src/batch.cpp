@@ -0,0 +1,414 @@
+#include <batch.hpp>
+#include <decode.hpp>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define CHIP8_BATCH_SIMD 1
+#include <immintrin.h>
+#else
+#define CHIP8_BATCH_SIMD 0
+#endif
+
+namespace {
+
+const size_t LANE_ALIGN = 32;
+const size_t MIN_VECTOR_GROUP = 4; //Smaller groups are cheaper to step one lane at a time
+const int MAX_GROUPS = 8;          //Past this many distinct pcs the rest of the cycle runs scalar
+
+#if CHIP8_BATCH_SIMD
+
+//Byte lanes for 8-bit fields, half as many 16-bit lanes for pc, I and opcode
+#if defined(__AVX2__)
+typedef __m256i Vec;
+const size_t VEC_BYTES = 32;
+inline Vec Load(const void* p) {return _mm256_loadu_si256(static_cast<const __m256i*>(p));}
+inline void Store(void* p, Vec v) {_mm256_storeu_si256(static_cast<__m256i*>(p), v);}
+inline Vec Splat8(uint8_t v) {return _mm256_set1_epi8(static_cast<char>(v));}
+inline Vec Splat16(uint16_t v) {return _mm256_set1_epi16(static_cast<short>(v));}
+inline Vec Add8(Vec a, Vec b) {return _mm256_add_epi8(a, b);}
+inline Vec Sub8(Vec a, Vec b) {return _mm256_sub_epi8(a, b);}
+inline Vec SubSat8(Vec a, Vec b) {return _mm256_subs_epu8(a, b);}
+inline Vec Add16(Vec a, Vec b) {return _mm256_add_epi16(a, b);}
+inline Vec And(Vec a, Vec b) {return _mm256_and_si256(a, b);}
+inline Vec Or(Vec a, Vec b) {return _mm256_or_si256(a, b);}
+inline Vec Xor(Vec a, Vec b) {return _mm256_xor_si256(a, b);}
+inline Vec AndNot(Vec a, Vec b) {return _mm256_andnot_si256(a, b);}
+inline Vec Eq8(Vec a, Vec b) {return _mm256_cmpeq_epi8(a, b);}
+inline Vec Min8(Vec a, Vec b) {return _mm256_min_epu8(a, b);}
+inline Vec Max8(Vec a, Vec b) {return _mm256_max_epu8(a, b);}
+inline Vec Shr16(Vec a, int n) {return _mm256_srli_epi16(a, n);}
+inline Vec Widen(const uint8_t* mask) {return _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(mask)));}
+#else
+typedef __m128i Vec;
+const size_t VEC_BYTES = 16;
+inline Vec Load(const void* p) {return _mm_loadu_si128(static_cast<const __m128i*>(p));}
+inline void Store(void* p, Vec v) {_mm_storeu_si128(static_cast<__m128i*>(p), v);}
+inline Vec Splat8(uint8_t v) {return _mm_set1_epi8(static_cast<char>(v));}
+inline Vec Splat16(uint16_t v) {return _mm_set1_epi16(static_cast<short>(v));}
+inline Vec Add8(Vec a, Vec b) {return _mm_add_epi8(a, b);}
+inline Vec Sub8(Vec a, Vec b) {return _mm_sub_epi8(a, b);}
+inline Vec SubSat8(Vec a, Vec b) {return _mm_subs_epu8(a, b);}
+inline Vec Add16(Vec a, Vec b) {return _mm_add_epi16(a, b);}
+inline Vec And(Vec a, Vec b) {return _mm_and_si128(a, b);}
+inline Vec Or(Vec a, Vec b) {return _mm_or_si128(a, b);}
+inline Vec Xor(Vec a, Vec b) {return _mm_xor_si128(a, b);}
+inline Vec AndNot(Vec a, Vec b) {return _mm_andnot_si128(a, b);}
+inline Vec Eq8(Vec a, Vec b) {return _mm_cmpeq_epi8(a, b);}
+inline Vec Min8(Vec a, Vec b) {return _mm_min_epu8(a, b);}
+inline Vec Max8(Vec a, Vec b) {return _mm_max_epu8(a, b);}
+inline Vec Shr16(Vec a, int n) {return _mm_srli_epi16(a, n);}
+inline Vec Widen(const uint8_t* mask) {Vec m = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(mask)); return _mm_unpacklo_epi8(m, m);}
+#endif
+
+const size_t VEC_WORDS = VEC_BYTES / 2;
+
+//mask ? a : b, masks are all ones or all zeros per lane
+inline Vec Select(Vec mask, Vec a, Vec b) {return Or(And(mask, a), AndNot(mask, b));}
+
+#endif
+
+bool Vectorizable(Op op)
+{
+#if CHIP8_BATCH_SIMD
+    switch (op)
+    {
+        case Op::Nop: case Op::Jp: case Op::LdI:
+        case Op::SeImm: case Op::SneImm: case Op::SeReg: case Op::SneReg:
+        case Op::LdImm: case Op::AddImm: case Op::LdReg:
+        case Op::Or: case Op::And: case Op::Xor:
+        case Op::AddReg: case Op::Sub: case Op::Shr: case Op::Subn: case Op::Shl:
+            return true;
+        default:
+            return false;
+    }
+#else
+    (void)op;
+    return false;
+#endif
+}
+
+}
+
+Chip8Batch::Chip8Batch(size_t count)
+    : lanes(count),
+      stride((count + LANE_ALIGN - 1) / LANE_ALIGN * LANE_ALIGN),
+      machines(count),
+      V(16 * stride), keypad(16 * stride),
+      pc(stride), I(stride), opcode(stride),
+      sp(stride), delayTimer(stride), soundTimer(stride), executed(stride),
+      active(stride), remaining(stride), group(stride), condition(stride), memoryWritten(stride)
+{
+    std::fill(active.begin(), active.begin() + lanes, 0xFF);
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        machines[lane].Initialize();
+        machines[lane].SetEngine(Engine::Table);
+        Gather(lane);
+    }
+}
+
+bool Chip8Batch::LoadROM(const std::filesystem::path& filename)
+{
+    //Load once and copy the machine, every lane starts from the same image
+    Chip8 image;
+    image.Initialize();
+    if (!image.LoadROM(filename))
+        return false;
+    LoadMachine(image);
+    return true;
+}
+
+void Chip8Batch::LoadMachine(const Chip8& machine)
+{
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        uint32_t rng = machines[lane].rngState; //Keep per-lane seeds
+        machines[lane] = machine;
+        machines[lane].rngState = rng;
+        machines[lane].trace = nullptr; //One ring can't take interleaved lanes, and it reads the source's registers
+        machines[lane].SetEngine(Engine::Table);
+        machines[lane].SetQuirks(quirks);
+        Gather(lane);
+        memoryWritten[lane] = 0;
+    }
+    anyMemoryWritten = false;
+}
+
+void Chip8Batch::SeedRandom(uint32_t seed)
+{
+    for (size_t lane = 0; lane < lanes; ++lane)
+        machines[lane].SeedRandom(seed + static_cast<uint32_t>(lane));
+}
+
+void Chip8Batch::SetQuirks(QuirkProfile profile)
+{
+    quirks = profile;
+    shiftVx = WithQuirks(profile, [](auto policy) { return decltype(policy)::shiftVx; });
+    for (Chip8& machine : machines)
+        machine.SetQuirks(profile);
+}
+
+void Chip8Batch::Gather(size_t lane)
+{
+    const Chip8& m = machines[lane];
+    for (int r = 0; r < 16; ++r) {
+        V[r * stride + lane] = m.registers[r];
+        keypad[r * stride + lane] = m.keypad[r];
+    }
+    pc[lane] = m.pc;
+    I[lane] = m.I;
+    opcode[lane] = m.opcode;
+    sp[lane] = m.sp;
+    delayTimer[lane] = m.delayTimer;
+    soundTimer[lane] = m.soundTimer;
+    executed[lane] = m.executed;
+}
+
+void Chip8Batch::Scatter(size_t lane)
+{
+    Chip8& m = machines[lane];
+    for (int r = 0; r < 16; ++r) {
+        m.registers[r] = V[r * stride + lane];
+        m.keypad[r] = keypad[r * stride + lane];
+    }
+    m.pc = pc[lane];
+    m.I = I[lane];
+    m.opcode = opcode[lane];
+    m.sp = sp[lane];
+    m.delayTimer = delayTimer[lane];
+    m.soundTimer = soundTimer[lane];
+    m.executed = executed[lane];
+}
+
+const Chip8& Chip8Batch::Lane(size_t lane)
+{
+    Scatter(lane);
+    return machines[lane];
+}
+
+void Chip8Batch::StepScalar(size_t lane)
+{
+    Scatter(lane);
+    Chip8& m = machines[lane];
+    m.Run(1);
+    Gather(lane);
+
+    //Stores can change code in this lane only, after that its opcodes must be checked
+    Op op = DecodeTable()[m.opcode].op;
+    if ((op == Op::LdBVx || op == Op::StoreRegs) && !memoryWritten[lane]) {
+        memoryWritten[lane] = 1;
+        anyMemoryWritten = true;
+    }
+}
+
+void Chip8Batch::Run(uint64_t cycles)
+{
+    for (uint64_t i = 0; i < cycles; ++i)
+        Step();
+}
+
+void Chip8Batch::Step()
+{
+    const Instruction* table = DecodeTable();
+
+    //Fast path: every lane at one pc running identical code
+    uint16_t first = pc[0];
+    bool uniform = !anyMemoryWritten && first < 4095;
+    for (size_t lane = 1; lane < lanes && uniform; ++lane)
+        uniform = pc[lane] == first;
+
+    if (uniform) {
+        const uint8_t* code = machines[0].memory;
+        const Instruction& in = table[code[first] << 8 | code[first + 1]];
+        if (lanes >= MIN_VECTOR_GROUP && Vectorizable(in.op) && StepVector(in, active.data())) {
+            for (size_t lane = 0; lane < lanes; ++lane)
+                ++executed[lane];
+            vectorLaneInstructions += lanes;
+            laneInstructions += lanes;
+            return;
+        }
+    }
+
+    std::copy(active.begin(), active.end(), remaining.begin());
+    size_t left = lanes;
+    size_t leader = 0;
+
+    //Each pass takes the lanes sharing the first remaining lane's pc and steps them together
+    for (int groups = 0; left > 0; ++groups) {
+        while (!remaining[leader])
+            ++leader;
+
+        if (groups == MAX_GROUPS) {
+            for (size_t lane = leader; lane < lanes; ++lane) {
+                if (remaining[lane])
+                    StepScalar(lane);
+            }
+            break;
+        }
+
+        uint16_t target = pc[leader];
+        size_t count = 0;
+        for (size_t lane = 0; lane < stride; ++lane) {
+            group[lane] = remaining[lane] & (pc[lane] == target ? 0xFF : 0x00);
+            count += group[lane] & 1;
+        }
+
+        const uint8_t* code = machines[leader].memory;
+        bool inRange = target < 4095;
+        uint16_t raw = inRange ? (code[target] << 8 | code[target + 1]) : 0;
+
+        //Lanes whose memory was written may hold different code at the same pc. If the leader wrote,
+        //its code may differ from lanes that never did, so then every lane is checked
+        bool leaderWritten = memoryWritten[leader] != 0;
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            if (group[lane] && (memoryWritten[lane] || leaderWritten) && inRange) {
+                const uint8_t* own = machines[lane].memory;
+                if ((own[target] << 8 | own[target + 1]) != raw) {
+                    StepScalar(lane);
+                    group[lane] = 0;
+                    remaining[lane] = 0;
+                    --count;
+                    --left;
+                }
+            }
+        }
+
+        const Instruction& in = table[raw];
+        bool vectored = inRange && count >= MIN_VECTOR_GROUP && Vectorizable(in.op) && StepVector(in, group.data());
+        if (vectored)
+            vectorLaneInstructions += count;
+
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            if (group[lane]) {
+                if (!vectored)
+                    StepScalar(lane);
+                else
+                    ++executed[lane];
+                remaining[lane] = 0;
+            }
+        }
+        left -= count;
+    }
+
+    laneInstructions += lanes;
+}
+
+bool Chip8Batch::StepVector(const Instruction& in, const uint8_t* mask)
+{
+#if CHIP8_BATCH_SIMD
+    uint8_t* vx = &V[in.x * stride];
+    uint8_t* vy = &V[in.y * stride];
+    uint8_t* vf = &V[0xF * stride];
+    Vec nn = Splat8(in.nn);
+    Vec one = Splat8(1);
+    bool writesFlag = false;
+    bool isSkip = false;
+
+    //Register results first; VF is written after VX, as the interpreter does
+    for (size_t i = 0; i < stride; i += VEC_BYTES) {
+        Vec m = Load(&mask[i]);
+        Vec a = Load(vx + i);
+        Vec b = Load(vy + i);
+        Vec r = a;
+        Vec flag = Splat8(0);
+
+        switch (in.op)
+        {
+            case Op::LdImm:  r = nn; break;
+            case Op::AddImm: r = Add8(a, nn); break;
+            case Op::LdReg:  r = b; break;
+            case Op::Or:     r = Or(a, b); break;
+            case Op::And:    r = And(a, b); break;
+            case Op::Xor:    r = Xor(a, b); break;
+
+            case Op::AddReg: //Carry when the wrapped sum is below an input
+                r = Add8(a, b);
+                flag = AndNot(Eq8(Min8(r, a), a), one);
+                writesFlag = true;
+                break;
+
+            case Op::Sub:    //No borrow when a >= b
+                r = Sub8(a, b);
+                flag = And(Eq8(Max8(a, b), a), one);
+                writesFlag = true;
+                break;
+
+            case Op::Subn:
+                r = Sub8(b, a);
+                flag = And(Eq8(Max8(b, a), b), one);
+                writesFlag = true;
+                break;
+
+            case Op::Shr:
+            {
+                Vec s = shiftVx ? a : b;
+                r = And(Shr16(s, 1), Splat8(0x7F));
+                flag = And(s, one);
+                writesFlag = true;
+                break;
+            }
+
+            case Op::Shl:
+            {
+                Vec s = shiftVx ? a : b;
+                r = Add8(s, s);
+                flag = And(Shr16(s, 7), one);
+                writesFlag = true;
+                break;
+            }
+
+            case Op::SeImm:  Store(&condition[i], Eq8(a, nn)); isSkip = true; break;
+            case Op::SneImm: Store(&condition[i], AndNot(Eq8(a, nn), Splat8(0xFF))); isSkip = true; break;
+            case Op::SeReg:  Store(&condition[i], Eq8(a, b)); isSkip = true; break;
+            case Op::SneReg: Store(&condition[i], AndNot(Eq8(a, b), Splat8(0xFF))); isSkip = true; break;
+
+            default: break;
+        }
+
+        Store(vx + i, Select(m, r, a));
+        if (writesFlag)
+            Store(vf + i, Select(m, flag, Load(vf + i)));
+    }
+
+    Vec two = Splat16(2);
+    Vec nnn = Splat16(in.nnn);
+    Vec raw = Splat16(in.opcode);
+    for (size_t i = 0; i < stride; i += VEC_WORDS) {
+        Vec m = Widen(&mask[i]);
+        Vec p = Load(&pc[i]);
+
+        if (in.op == Op::Jp)
+            p = Select(m, nnn, p);
+        else if (isSkip)
+            p = Add16(p, And(m, Add16(two, And(Widen(&condition[i]), two))));
+        else
+            p = Add16(p, And(m, two));
+
+        if (in.op == Op::LdI)
+            Store(&I[i], Select(m, nnn, Load(&I[i])));
+
+        Store(&pc[i], p);
+        Store(&opcode[i], Select(m, raw, Load(&opcode[i])));
+    }
+    return true;
+#else
+    (void)in;
+    (void)mask;
+    return false;
+#endif
+}
+
+void Chip8Batch::TickTimers()
+{
+#if CHIP8_BATCH_SIMD
+    Vec one = Splat8(1);
+    for (size_t i = 0; i < stride; i += VEC_BYTES) {
+        Store(&delayTimer[i], SubSat8(Load(&delayTimer[i]), one));
+        Store(&soundTimer[i], SubSat8(Load(&soundTimer[i]), one));
+    }
+#else
+    for (size_t i = 0; i < stride; ++i) {
+        delayTimer[i] -= delayTimer[i] > 0;
+        soundTimer[i] -= soundTimer[i] > 0;
+    }
+#endif
+}
@@ -0,0 +1,75 @@
+#include <beeper.hpp>
+#include <chrono>
+
+static int64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//PolyBLEP residual for a step at phase 0, t is the phase and dt the phase increment
+static double PolyBlep(double t, double dt)
+{
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1.0;
+    }
+    if (t > 1.0 - dt) {
+        t = (t - 1.0) / dt;
+        return t * t + t + t + 1.0;
+    }
+    return 0.0;
+}
+
+Beeper::Beeper(int sampleRate, int bufferFrames, double frequency, float volume)
+    : increment(frequency / sampleRate),
+      latency(static_cast<int64_t>(2.0 * bufferFrames * 1e9 / sampleRate)),
+      sampleRate(sampleRate),
+      volume(volume),
+      ramp(static_cast<float>(volume / (0.002 * sampleRate))) //2 ms fade
+{
+}
+
+void Beeper::SetTone(bool on)
+{
+    queue.TryPush(Transition{Now(), on});
+}
+
+void Beeper::Render(float* out, size_t frames)
+{
+    //This buffer starts playing about one buffer from now and a transition is due latency after its stamp,
+    //so the ones stamped during the last callback period land inside this buffer with their spacing kept
+    int64_t playStart = Now() + latency / 2;
+
+    for (size_t i = 0; i < frames; ++i) {
+        int64_t sampleTime = playStart + static_cast<int64_t>(i * 1e9 / sampleRate);
+        while (hasNext || queue.TryPop(next)) {
+            hasNext = true;
+            if (next.time + latency > sampleTime)
+                break;
+            gate = next.on;
+            hasNext = false;
+        }
+
+        float target = gate ? volume : 0.0f;
+        if (level < target)
+            level = level + ramp < target ? level + ramp : target;
+        else if (level > target)
+            level = level - ramp > target ? level - ramp : target;
+
+        if (level == 0.0f) {
+            out[i] = 0.0f;
+            continue;
+        }
+
+        //Naive square with both edges smoothed by PolyBLEP, keeps the harmonics above Nyquist from aliasing
+        double value = phase < 0.5 ? 1.0 : -1.0;
+        value += PolyBlep(phase, increment);
+        double shifted = phase + 0.5;
+        value -= PolyBlep(shifted - static_cast<int>(shifted), increment);
+        out[i] = static_cast<float>(value) * level;
+
+        phase += increment;
+        if (phase >= 1.0)
+            phase -= 1.0;
+    }
+}
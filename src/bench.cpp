@@ -0,0 +1,502 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <chip8.hpp>
+#include <fork.hpp>
+#include <frame_server.hpp>
+
+const uint64_t DEFAULT_CYCLES = 5000000;
+const uint64_t DEFAULT_REPETITIONS = 5;
+const double DEFAULT_THRESHOLD = 5.0; //Percent
+const uint64_t EXPAND_FRAMES = 20000; //RGBA conversions per repetition
+const uint64_t FORK_BRANCHES = 20000; //Search tree nodes per repetition
+const size_t FORK_FRONTIER = 256;
+const uint64_t SERVE_FRAMES = 12000; //Frames streamed per repetition
+const uint32_t SERVE_BATCH = 60;     //Frames per batched Run request
+
+//Tiny assembler for the synthetic ROMs, addresses start at 0x200
+class RomBuilder {
+
+public:
+     uint16_t Here() const
+          {return static_cast<uint16_t>(0x200 + bytes.size());}
+     RomBuilder& Op(uint16_t opcode)
+     {
+          bytes.push_back(static_cast<uint8_t>(opcode >> 8));
+          bytes.push_back(static_cast<uint8_t>(opcode));
+          return *this;
+     }
+     RomBuilder& Data(std::initializer_list<uint8_t> data)
+     {
+          bytes.insert(bytes.end(), data);
+          return *this;
+     }
+     void Patch(uint16_t address, uint16_t opcode) //Fill in a forward reference
+     {
+          bytes[address - 0x200] = static_cast<uint8_t>(opcode >> 8);
+          bytes[address - 0x200 + 1] = static_cast<uint8_t>(opcode);
+     }
+
+     std::vector<uint8_t> bytes;
+};
+
+//8XY4/8XY5 chains with carry and borrow
+static std::vector<uint8_t> AluRom()
+{
+     RomBuilder rom;
+     rom.Op(0x6001).Op(0x6103).Op(0x6207).Op(0x63FF);
+     uint16_t loop = rom.Here();
+     rom.Op(0x8014).Op(0x8125).Op(0x8234).Op(0x8305)
+        .Op(0x8014).Op(0x8135).Op(0x8204).Op(0x8315)
+        .Op(0x1000 | loop);
+     return rom.bytes;
+}
+
+//3XNN/4XNN/5XY0/9XY0 skips over jumps, both paths meet at the next test
+static std::vector<uint8_t> BranchRom()
+{
+     RomBuilder rom;
+     rom.Op(0x6000).Op(0x6105);
+     uint16_t loop = rom.Here();
+     rom.Op(0x7001);
+     rom.Op(0x3000); rom.Op(0x1000 | (rom.Here() + 2));
+     rom.Op(0x4005); rom.Op(0x1000 | (rom.Here() + 2));
+     rom.Op(0x5010); rom.Op(0x1000 | (rom.Here() + 2));
+     rom.Op(0x9010); rom.Op(0x1000 | (rom.Here() + 2));
+     rom.Op(0x1000 | loop);
+     return rom.bytes;
+}
+
+//Nested 2NNN/00EE
+static std::vector<uint8_t> CallRom()
+{
+     RomBuilder rom;
+     uint16_t loop = rom.Here();
+     rom.Op(0x2000).Op(0x2000).Op(0x1000 | loop);
+     uint16_t outer = rom.Here();
+     rom.Op(0x2000).Op(0x00EE);
+     uint16_t inner = rom.Here();
+     rom.Op(0x7001).Op(0x00EE);
+     rom.Patch(loop, 0x2000 | outer);
+     rom.Patch(loop + 2, 0x2000 | outer);
+     rom.Patch(outer, 0x2000 | inner);
+     return rom.bytes;
+}
+
+//15 row sprites walking diagonally so they keep wrapping over both edges
+static std::vector<uint8_t> DrawRom()
+{
+     RomBuilder rom;
+     rom.Op(0xA000).Op(0x603C).Op(0x611E);
+     uint16_t loop = rom.Here();
+     rom.Op(0xD01F).Op(0x7003).Op(0x7101).Op(0x1000 | loop);
+     uint16_t sprite = rom.Here();
+     rom.Data({0xFF, 0x81, 0xBD, 0xA5, 0xA5, 0xBD, 0x81, 0xFF, 0xAA, 0x55, 0xAA, 0x55, 0xF0, 0x0F, 0xFF});
+     rom.Patch(0x200, 0xA000 | sprite);
+     return rom.bytes;
+}
+
+static std::vector<uint8_t> ClsRom()
+{
+     RomBuilder rom;
+     rom.Op(0x00E0).Op(0x00E0).Op(0x00E0).Op(0x1200);
+     return rom.bytes;
+}
+
+//FX33/FX55/FX65 round trips through memory outside the program
+static std::vector<uint8_t> MemoryRom()
+{
+     RomBuilder rom;
+     uint16_t loop = rom.Here();
+     rom.Op(0xA300).Op(0xF533).Op(0xFF55).Op(0xFF65).Op(0x7501).Op(0x1000 | loop);
+     return rom.bytes;
+}
+
+//A game-like frame: move a sprite by CXNN, redraw it, print a BCD score digit and set the delay timer
+static std::vector<uint8_t> MixedRom()
+{
+     RomBuilder rom;
+     rom.Op(0xA000).Op(0x6A00).Op(0x6B00);
+     uint16_t loop = rom.Here();
+     rom.Op(0xDAB5).Op(0xC703).Op(0x8A74).Op(0x7B01).Op(0xDAB5).Op(0x2000)
+        .Op(0x3A00).Op(0x7C01).Op(0x8CA2).Op(0x1000 | loop);
+     uint16_t score = rom.Here();
+     rom.Op(0xA300).Op(0xFA33).Op(0xF265).Op(0xF129).Op(0x6D30).Op(0x6E00)
+        .Op(0xDDE5).Op(0xDDE5).Op(0xF015);
+     uint16_t restore = rom.Here();
+     rom.Op(0xA000).Op(0x00EE); //Point I back at the player sprite
+     uint16_t sprite = rom.Here();
+     rom.Data({0x3C, 0x7E, 0xFF, 0x7E, 0x3C});
+     rom.Patch(0x200, 0xA000 | sprite);
+     rom.Patch(restore, 0xA000 | sprite);
+     rom.Patch(loop + 10, 0x2000 | score);
+     return rom.bytes;
+}
+
+struct Workload {
+     const char* name;
+     std::vector<uint8_t> (*build)();
+};
+
+static const Workload WORKLOADS[] = {
+     {"alu", AluRom},
+     {"branch", BranchRom},
+     {"call", CallRom},
+     {"draw", DrawRom},
+     {"cls", ClsRom},
+     {"memory", MemoryRom},
+     {"mixed", MixedRom},
+};
+
+static const struct {
+     const char* name;
+     Engine engine;
+} ENGINES[] = {
+     {"switch", Engine::Switch},
+     {"table", Engine::Table},
+     {"cached", Engine::Cached},
+     {"jit", Engine::Jit},
+};
+
+struct Options {
+     uint64_t cycles = DEFAULT_CYCLES;
+     uint64_t repetitions = DEFAULT_REPETITIONS;
+     double threshold = DEFAULT_THRESHOLD;
+     std::string filter;
+     std::string savePath;
+     std::string baselinePath;
+};
+
+//Mean, spread and best of the per-repetition timings, all in ns per unit of work
+struct Sample {
+     double mean = 0.0;
+     double stddev = 0.0;
+     double best = 0.0;
+};
+
+static Sample Summarize(const std::vector<double>& values)
+{
+     Sample sample;
+     for (double value : values)
+          sample.mean += value;
+     sample.mean /= values.size();
+     for (double value : values)
+          sample.stddev += (value - sample.mean) * (value - sample.mean);
+     sample.stddev = values.size() > 1 ? std::sqrt(sample.stddev / (values.size() - 1)) : 0.0;
+     sample.best = *std::min_element(values.begin(), values.end());
+     return sample;
+}
+
+static void LoadImage(Chip8& chip8, const std::vector<uint8_t>& rom)
+{
+     chip8.Initialize();
+     memcpy(chip8.GetMemory() + 0x200, rom.data(), rom.size());
+     chip8.InvalidateCode(0x200, static_cast<uint16_t>(rom.size()));
+     chip8.SeedRandom(1);
+}
+
+static Sample BenchInterpreter(const std::vector<uint8_t>& rom, Engine engine, const Options& options)
+{
+     std::vector<double> timings;
+     for (uint64_t rep = 0; rep < options.repetitions; ++rep) {
+          Chip8 chip8;
+          LoadImage(chip8, rom);
+          chip8.SetEngine(engine);
+          chip8.Run(options.cycles / 100); //Warm up the decode cache and JIT blocks
+
+          auto start = std::chrono::steady_clock::now();
+          chip8.Run(options.cycles);
+          double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          timings.push_back(seconds * 1e9 / options.cycles);
+     }
+     return Summarize(timings);
+}
+
+//Keeps the compiler from dropping repeated conversions of the same frame
+static void Consume(const uint32_t* pixels)
+{
+#if defined(__GNUC__)
+     asm volatile("" : : "r"(pixels) : "memory");
+#else
+     static volatile uint32_t sink;
+     sink = pixels[0];
+#endif
+}
+
+static Sample BenchExpand(const Options& options)
+{
+     //Convert a busy screen, the cost of the conversion does not depend on the contents but a blank one could flatter it
+     Chip8 chip8;
+     LoadImage(chip8, MixedRom());
+     chip8.Run(100000);
+
+     static uint32_t pixels[64 * 32];
+     std::vector<double> timings;
+     for (uint64_t rep = 0; rep < options.repetitions; ++rep) {
+          auto start = std::chrono::steady_clock::now();
+          for (uint64_t frame = 0; frame < EXPAND_FRAMES; ++frame) {
+               chip8.ExpandDisplay(pixels, ON_COLOR, OFF_COLOR);
+               Consume(pixels);
+          }
+          double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          timings.push_back(seconds * 1e9 / EXPAND_FRAMES);
+     }
+     return Summarize(timings);
+}
+
+//Tree search on the memory workload: restore a frontier node, press a key, run a frame, fork a child
+static Sample BenchFork(const Options& options)
+{
+     Chip8 chip8;
+     LoadImage(chip8, MemoryRom());
+     chip8.Run(1000);
+
+     std::vector<double> timings;
+     for (uint64_t rep = 0; rep < options.repetitions; ++rep) {
+          std::vector<ForkNode> frontier(FORK_FRONTIER, ForkNode(chip8));
+          std::vector<ForkNode> children(FORK_FRONTIER, frontier[0]);
+          Chip8 scratch = chip8;
+          frontier[0].Restore(scratch);
+          const ForkNode* loaded = &frontier[0];
+
+          auto start = std::chrono::steady_clock::now();
+          for (uint64_t branch = 0; branch < FORK_BRANCHES; ++branch) {
+               size_t slot = branch % FORK_FRONTIER;
+               if (slot == 0 && branch > 0)
+                    frontier.swap(children);
+
+               frontier[slot].Restore(scratch, *loaded);
+               scratch.keypad[branch & 0xF] ^= 1;
+               scratch.Run(15);
+               children[slot] = frontier[slot].Fork(scratch);
+               loaded = &frontier[slot];
+          }
+          double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          timings.push_back(seconds * 1e9 / FORK_BRANCHES);
+     }
+     return Summarize(timings);
+}
+
+//Frame server round trips over a real socket, the server on its own thread running the mixed workload
+//at 15 instructions per frame. Stepping asks for one frame per request, batched for SERVE_BATCH.
+struct ServeCase {
+     const char* name;
+     FrameProtocol::Format format;
+     uint32_t framesPerRequest;
+};
+
+static const ServeCase SERVE_CASES[] = {
+     {"serve_delta", FrameProtocol::Format::Delta, 1},
+     {"serve_rows", FrameProtocol::Format::Rows, 1},
+     {"serve_rgba", FrameProtocol::Format::Rgba, 1},
+     {"serve_run60", FrameProtocol::Format::Delta, SERVE_BATCH},
+};
+
+static bool BenchServe(const ServeCase& serveCase, const Options& options, Sample& sample, double& bytesPerFrame)
+{
+     std::filesystem::path socketPath = std::filesystem::temp_directory_path() /
+          ("chip8_bench_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + ".sock");
+
+     Chip8 chip8;
+     LoadImage(chip8, MixedRom());
+     FrameServer server(chip8, 15);
+     if (!server.Listen(socketPath))
+          return false;
+     std::thread serving([&server] { server.Serve(); });
+
+     FrameClient client;
+     if (!client.Connect(socketPath))
+          std::exit(1); //The server thread is blocked in accept with nothing to wake it
+
+     std::vector<double> timings;
+     uint64_t frames = 0;
+     bool ok = true;
+     for (uint64_t rep = 0; rep < options.repetitions && ok; ++rep) {
+          auto start = std::chrono::steady_clock::now();
+          for (uint64_t frame = 0; frame < SERVE_FRAMES && ok; frame += serveCase.framesPerRequest) {
+               ok = serveCase.framesPerRequest == 1 ? client.Step(1, serveCase.format)
+                                                    : client.Run(serveCase.framesPerRequest, serveCase.format);
+          }
+          double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+          timings.push_back(seconds * 1e9 / SERVE_FRAMES);
+          frames += SERVE_FRAMES;
+     }
+     uint64_t received = client.BytesReceived();
+     client.Quit();
+     serving.join();
+
+     if (!ok || memcmp(client.Rows(), chip8.gfx, sizeof(chip8.gfx)) != 0) {
+          std::cerr << serveCase.name << ": the client's display does not match the server's" << std::endl;
+          return false;
+     }
+     sample = Summarize(timings);
+     bytesPerFrame = static_cast<double>(received) / frames;
+     return true;
+}
+
+static std::map<std::string, double> LoadBaseline(const std::string& path)
+{
+     std::map<std::string, double> baseline;
+     std::ifstream file(path);
+     std::string name;
+     double value;
+     while (file >> name >> value)
+          baseline[name] = value;
+     return baseline;
+}
+
+static void PrintUsage(const char* program)
+{
+     std::cerr << "Usage: " << program << " [options]\n"
+               << "  --cycles N          Instructions per repetition (default " << DEFAULT_CYCLES << ")\n"
+               << "  --reps N            Repetitions per benchmark (default " << DEFAULT_REPETITIONS << ")\n"
+               << "  --filter TEXT       Only run benchmarks whose name contains TEXT\n"
+               << "  --save-baseline F   Write the mean of each benchmark to F\n"
+               << "  --baseline F        Compare against F and fail on regressions\n"
+               << "  --threshold PCT     Slowdown that counts as a regression (default " << DEFAULT_THRESHOLD << ")\n";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options)
+{
+     for (int i = 1; i < argc; ++i) {
+          std::string arg = argv[i];
+          bool hasValue = i + 1 < argc;
+          char* end = nullptr;
+
+          if (arg == "--cycles" && hasValue) {
+               options.cycles = std::strtoull(argv[++i], &end, 10);
+               if (*end != '\0' || options.cycles == 0)
+                    return false;
+          }
+          else if (arg == "--reps" && hasValue) {
+               options.repetitions = std::strtoull(argv[++i], &end, 10);
+               if (*end != '\0' || options.repetitions == 0)
+                    return false;
+          }
+          else if (arg == "--threshold" && hasValue) {
+               options.threshold = std::strtod(argv[++i], &end);
+               if (*end != '\0' || options.threshold < 0.0)
+                    return false;
+          }
+          else if (arg == "--filter" && hasValue) {
+               options.filter = argv[++i];
+          }
+          else if (arg == "--save-baseline" && hasValue) {
+               options.savePath = argv[++i];
+          }
+          else if (arg == "--baseline" && hasValue) {
+               options.baselinePath = argv[++i];
+          }
+          else {
+               return false;
+          }
+     }
+     return true;
+}
+
+int main(int argc, char* argv[]) {
+
+     Options options;
+     if (!ParseOptions(argc, argv, options)) {
+          PrintUsage(argv[0]);
+          return 1;
+     }
+
+     std::map<std::string, double> baseline;
+     if (!options.baselinePath.empty()) {
+          baseline = LoadBaseline(options.baselinePath);
+          if (baseline.empty()) {
+               std::cerr << "Could not read baseline: " << options.baselinePath << std::endl;
+               return 1;
+          }
+     }
+
+     std::vector<std::pair<std::string, double>> results;
+     int regressions = 0;
+
+     std::cout << std::left << std::setw(20) << "benchmark" << std::right
+               << std::setw(12) << "ns/unit" << std::setw(10) << "stddev" << std::setw(10) << "best"
+               << std::setw(14) << "units/sec" << "  vs baseline\n";
+
+     auto report = [&](const std::string& name, const Sample& sample) {
+          std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3)
+                    << std::setw(12) << sample.mean << std::setw(10) << sample.stddev << std::setw(10) << sample.best
+                    << std::setw(14) << static_cast<uint64_t>(1e9 / sample.mean);
+
+          auto previous = baseline.find(name);
+          if (previous != baseline.end()) {
+               double change = (sample.mean / previous->second - 1.0) * 100.0;
+               std::cout << "  " << std::showpos << std::setprecision(1) << change << "%" << std::noshowpos;
+               if (change > options.threshold) {
+                    std::cout << " REGRESSION";
+                    ++regressions;
+               }
+          }
+          std::cout << std::endl;
+          results.emplace_back(name, sample.mean);
+     };
+
+     //ns/unit is ns/instruction for the interpreters, ns/frame for the RGBA conversion and the frame server,
+     //and ns/node for forking
+     for (const Workload& workload : WORKLOADS) {
+          std::vector<uint8_t> rom = workload.build();
+          for (const auto& engine : ENGINES) {
+               std::string name = std::string(workload.name) + "/" + engine.name;
+               if (name.find(options.filter) == std::string::npos)
+                    continue;
+               report(name, BenchInterpreter(rom, engine.engine, options));
+          }
+     }
+
+     if (std::string("expand_rgba").find(options.filter) != std::string::npos)
+          report("expand_rgba", BenchExpand(options));
+
+     if (std::string("fork").find(options.filter) != std::string::npos)
+          report("fork", BenchFork(options));
+
+     //Bandwidth goes in its own table, the baseline file only holds timings
+     std::vector<std::pair<std::string, double>> bandwidth;
+     for (const ServeCase& serveCase : SERVE_CASES) {
+          if (std::string(serveCase.name).find(options.filter) == std::string::npos)
+               continue;
+          Sample sample;
+          double bytesPerFrame = 0.0;
+          if (!BenchServe(serveCase, options, sample, bytesPerFrame))
+               return 1;
+          report(serveCase.name, sample);
+          bandwidth.emplace_back(serveCase.name, bytesPerFrame);
+     }
+     if (!bandwidth.empty()) {
+          std::cout << "\n" << std::left << std::setw(20) << "bandwidth" << std::right << std::setw(12) << "bytes/frame" << "\n";
+          for (const auto& entry : bandwidth)
+               std::cout << std::left << std::setw(20) << entry.first << std::right << std::setprecision(1)
+                         << std::setw(12) << entry.second << "\n";
+     }
+
+     if (!options.savePath.empty()) {
+          std::ofstream file(options.savePath);
+          file << std::setprecision(6);
+          for (const auto& result : results)
+               file << result.first << " " << result.second << "\n";
+          if (!file) {
+               std::cerr << "Could not write baseline: " << options.savePath << std::endl;
+               return 1;
+          }
+     }
+
+     if (regressions > 0) {
+          std::cerr << regressions << " benchmark(s) regressed by more than " << options.threshold << "%" << std::endl;
+          return 1;
+     }
+     return 0;
+}
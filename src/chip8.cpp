@@ -1,4 +1,8 @@
 #include <chip8.hpp>
+#include <decode.hpp>
+#include <rom_cache.hpp>
+#include <algorithm>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <filesystem>
@@ -30,44 +34,134 @@ void Chip8::Initialize()
     sp = 0;
 
     std::fill(memory, memory + 4096, 0);
-    std::fill(gfx, gfx + 64 * 32, 0); 
+    std::fill(gfx, gfx + 32, 0); 
+    MarkDisplayDirty(0xFFFFFFFF);
     std::fill(stack, stack + 16, 0);
     std::fill(registers, registers + 16, 0);
     std::fill(keypad, keypad + 16, 0);
 
     //Load fontset into memory starting at 0x50
-    for(int i = 0; i < 80; ++i)
-        memory[0x50 + i] = Chip8_fontset[i];
+    CopyFontset(memory);
+
+    InvalidateCode(0, 4096);
 }
 
-void Chip8::LoadROM(const std::filesystem::path& filename)
-{   
-    //Open the file as a stream of binary and move the file pointer to the end
-    std::ifstream rom(filename, std::ios::binary | std::ios::ate);
+bool Chip8::LoadROM(const std::filesystem::path& filename)
+{
+    std::shared_ptr<const RomImage> image = RomCache::Shared().Load(filename);
+    if (!image)
+        return false;
+
+    LoadImage(*image);
+    return true;
+}
+
+void Chip8::LoadImage(const RomImage& image)
+{
+    memcpy(memory, image.Memory(), sizeof(memory));
+    InvalidateCode(0, 4096);
+}
+
+void Chip8::CopyFontset(uint8_t* memory)
+{
+    memcpy(memory + 0x50, Chip8_fontset, sizeof(Chip8_fontset));
+}
+
+void Chip8::SeedRandom(uint32_t seed)
+{
+    rngState = seed ? seed : 0x2545F491; //xorshift gets stuck on zero
+}
+
+uint8_t Chip8::NextRandom()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState >> 24;
+}
+
+//Profiling hooks, nothing is left of them unless the core is built with CHIP8_PROFILE
+#ifdef CHIP8_PROFILE
+#define PROFILE_STEP() profile.Record(pc, memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF], sp)
+#define PROFILE_DRAW(x, y, height) profile.RecordDraw(x, y, height, registers[0xF])
+#else
+#define PROFILE_STEP() do {} while (0)
+#define PROFILE_DRAW(x, y, height) do {} while (0)
+#endif
+
+void Chip8::EmulateCycle()
+{
+    Run(1);
+}
+
+void Chip8::Run(uint64_t cycles)
+{
+    idle = false;
+    executed += cycles;
+    WithQuirks(quirks, [&](auto policy) { RunEngine<decltype(policy)>(cycles); });
+}
+
+void Chip8::SetTrace(TraceRing* ring)
+{
+    if (trace)
+        trace->Detach();
+    trace = ring;
+    if (trace)
+        trace->Attach(registers);
+}
 
-    if (rom.is_open())
+void Chip8::SetQuirks(QuirkProfile profile)
+{
+    if (profile == quirks)
+        return;
+    quirks = profile;
+    //Translated blocks bake in the shift quirk and the interpreter entry point
+    if (JitCache* cache = jit.Peek())
+        cache->Flush();
+}
+
+template<typename Quirks>
+void Chip8::RunEngine(uint64_t cycles)
+{
+    if (trace) {
+        if (engine == Engine::Switch || engine == Engine::Table)
+            RunInterpreter<false, Quirks, true>(cycles);
+        else
+            RunInterpreter<true, Quirks, true>(cycles);
+        return;
+    }
+
+    switch (engine)
     {
-        //Get size of the file and allocate a buffer to hold its contents
-        std::streampos size = rom.tellg();
-        char* buffer = new char[size];
+        case Engine::Switch:
+            for (uint64_t i = 0; i < cycles; ++i)
+                StepReference<Quirks>();
+            break;
 
-        //Go back to the beginning of the file and fill the buffer
-        rom.seekg(0, std::ios::beg);
-        rom.read(buffer, size);
-        rom.close();
+        case Engine::Table:
+            RunInterpreter<false, Quirks>(cycles);
+            break;
 
-        //Load the ROM into CHIP-8 memory, starts at 0x200
-        for(int i = 0; i < size; ++i)
-            memory[0x200 + i] = buffer[i];
+        case Engine::Cached:
+            RunInterpreter<true, Quirks>(cycles);
+            break;
 
-        delete[] buffer;
+        case Engine::Jit:
+#ifdef CHIP8_PROFILE
+            RunInterpreter<true, Quirks>(cycles); //Compiled blocks would skip the hooks
+#else
+            RunJit<Quirks>(cycles);
+#endif
+            break;
     }
 }
 
-void Chip8::EmulateCycle()
+template<typename Quirks>
+void Chip8::StepReference()
 {   
     //One opcode is 2 bytes long, shift left to make space, OR to merge
-    opcode = memory[pc] << 8 | memory[pc + 1]; //Fetch opcode
+    opcode = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF]; //Fetch opcode, wrapping at the end of memory
+    PROFILE_STEP();
 
     switch(opcode & 0xF000) //Decode opcode, pc + 2 to get to next instruction
     {
@@ -77,13 +171,14 @@ void Chip8::EmulateCycle()
             case 0x00E0: //CLS
             {
                 memset(gfx, 0, sizeof(gfx));
+                MarkDisplayDirty(0xFFFFFFFF);
                 pc += 2;
                 break;
             }
 
             case 0x00EE: //RET
             {
-                --sp;
+                sp = (sp - 1) & 0xF; //The 16-entry stack wraps rather than underflowing
                 pc = stack[sp];
                 pc += 2;
                 break;
@@ -106,7 +201,7 @@ void Chip8::EmulateCycle()
         case 0x2000: //2NNN - Call Address
         {
             stack[sp] = pc;
-            ++sp;
+            sp = (sp + 1) & 0xF; //A 17th nested call overwrites the oldest return address
             pc = opcode & 0x0FFF;
             break;
         }
@@ -225,9 +320,9 @@ void Chip8::EmulateCycle()
                     break;
                 }
                     
-                case 0x8006: //VX = VY >> 1, VF = LSB of VY
+                case 0x8006: //VX = VY >> 1, VF = LSB of VY (VX >> 1 with the shift quirk)
                 {
-                    uint8_t y = registers[Vy];
+                    uint8_t y = registers[Quirks::shiftVx ? Vx : Vy];
                     uint8_t result = y >> 1;
                     registers[Vx] = result;
                     registers[0xF] = y & 0x1;
@@ -250,9 +345,9 @@ void Chip8::EmulateCycle()
                     break;
                 }
 
-                case 0x800E: //VX = VY << 1, VF = MSB of VY
+                case 0x800E: //VX = VY << 1, VF = MSB of VY (VX << 1 with the shift quirk)
                 {
-                    uint8_t y = registers[Vy];
+                    uint8_t y = registers[Quirks::shiftVx ? Vx : Vy];
                     uint8_t result = y << 1;
                     registers[Vx] = result;
                     registers[0xF] = (y & 0x80) >> 7;
@@ -286,31 +381,62 @@ void Chip8::EmulateCycle()
             break;
         }
 
+        case 0xB000: //BNNN - Jump to NNN + V0 (BXNN - XNN + VX with the jump quirk)
+        {
+            pc = (opcode & 0x0FFF) + registers[Quirks::jumpVx ? (opcode & 0x0F00) >> 8 : 0];
+            break;
+        }
+
+        case 0xC000: //CXNN - Set VX to random byte AND NN
+        {
+            uint8_t Vx = (opcode & 0x0F00) >> 8;
+            registers[Vx] = NextRandom() & (opcode & 0x00FF);
+            pc += 2;
+            break;
+        }
+
         case 0xD000: 
         {
-            uint8_t x = registers[(opcode & 0x0F00) >> 8];
-            uint8_t y = registers[(opcode & 0x00F0) >> 4];
+            //The profiler gets the coordinates as the registers held them, before wrapping or VF changes
+            uint8_t startX = registers[(opcode & 0x0F00) >> 8];
+            uint8_t startY = registers[(opcode & 0x00F0) >> 4];
+            uint8_t x = startX;
+            uint8_t y = startY;
             uint8_t height = opcode & 0x000F;
+            if (Quirks::clipSprites) {
+                //The start position still wraps, pixels past the edges are dropped
+                x %= 64;
+                y %= 32;
+            }
+
+            uint32_t touched = 0;
 
             registers[0xF] = 0; //Reset collision register
 
             for (int row = 0; row < height; ++row) {
-                uint8_t pixel = memory[I + row];
+                uint8_t pixel = memory[(I + row) & 0xFFF];
                 for (int col = 0; col < 8; ++col) {
                     if ((pixel & (0x80 >> col)) != 0) { //Check if pixel is on
+                        if (Quirks::clipSprites && (x + col >= 64 || y + row >= 32))
+                            continue;
                         //Screen wrapping
                         int px = (x + col) % 64; 
                         int py = (y + row) % 32;
-                        int index = px + py * 64;
+                        uint64_t bit = 1ULL << (63 - px);
 
-                        if (gfx[index] == 1) {
+                        if (gfx[py] & bit) {
                             registers[0xF] = 1;
                         }
-                        gfx[index] ^= 1; //Draw using XOR
+                        gfx[py] ^= bit; //Draw using XOR
+                        touched |= 1u << py;
                     }
                 }
             }
 
+            if (touched)
+                MarkDisplayDirty(touched);
+            PROFILE_DRAW(startX, startY, height);
+
             pc += 2;
             break;
         }
@@ -318,7 +444,7 @@ void Chip8::EmulateCycle()
         case 0xE000: //EX__
         {
             uint8_t Vx = (opcode & 0x0F00) >> 8;
-            uint8_t key = registers[Vx];
+            uint8_t key = registers[Vx] & 0xF; //Only the low nibble names a key
             switch (opcode & 0xF0FF) {
 
                 case 0xE09E: //Skip next instruction if key in Vx is pressed
@@ -420,11 +546,12 @@ void Chip8::EmulateCycle()
                 case 0xF033: //Store binary-coded decimal of VX in I, I+1, I+2
                 {
                     uint8_t val = registers[Vx];
-                    memory[I+2] = val % 10; //Ones place
+                    memory[(I + 2) & 0xFFF] = val % 10; //Ones place
                     val /= 10;
-                    memory[I+1] = val % 10; //Tens place
+                    memory[(I + 1) & 0xFFF] = val % 10; //Tens place
                     val /= 10;
-                    memory[I] = val % 10; //Hundreds place
+                    memory[I & 0xFFF] = val % 10; //Hundreds place
+                    InvalidateCode(I, 3);
                     pc += 2;
                     break;
                 }
@@ -432,8 +559,11 @@ void Chip8::EmulateCycle()
                 case 0xF055: //Store V0 to VX in memory starting at I
                 {
                     for (uint8_t i = 0; i <= Vx; ++i) {
-                        memory[I+i] = registers[i]; 
+                        memory[(I + i) & 0xFFF] = registers[i];
                     }
+                    InvalidateCode(I, Vx + 1);
+                    if (Quirks::incrementI)
+                        I += Vx + 1;
                     pc += 2;
                     break;
                 }
@@ -441,8 +571,10 @@ void Chip8::EmulateCycle()
                 case 0xF065: //Load V0 to VX from memory starting at I
                 {
                     for (uint8_t i = 0; i <= Vx; ++i) {
-                        registers[i] = memory[I+i];
+                        registers[i] = memory[(I + i) & 0xFFF];
                     }
+                    if (Quirks::incrementI)
+                        I += Vx + 1;
                     pc += 2;
                     break;
                 }
@@ -458,16 +590,703 @@ void Chip8::EmulateCycle()
     }
 }
 
+//One rotate places a sprite row and wraps it around the right edge
+template<typename Quirks>
+void Chip8::Draw(uint8_t vx, uint8_t vy, uint8_t height)
+{
+    //The profiler gets the coordinates as the registers held them, like the reference interpreter
+    uint8_t startX = registers[vx];
+    uint8_t startY = registers[vy];
+    unsigned x = startX & 63;
+    unsigned y = startY;
+    uint64_t hit = 0;
+    uint32_t touched = 0;
+
+    if (Quirks::clipSprites)
+        y &= 31;
+
+    for (int row = 0; row < height; ++row) {
+        if (Quirks::clipSprites && y + row >= 32)
+            break;
+        uint64_t bits = static_cast<uint64_t>(memory[(I + row) & 0xFFF]) << 56;
+        if (Quirks::clipSprites)
+            bits >>= x; //Columns past the right edge fall off
+        else
+            bits = (bits >> x) | (bits << ((64 - x) & 63));
+        uint64_t& line = gfx[(y + row) & 31];
+        hit |= line & bits;
+        line ^= bits;
+        touched |= static_cast<uint32_t>(bits != 0) << ((y + row) & 31);
+    }
+    registers[0xF] = hit != 0;
+    if (touched)
+        MarkDisplayDirty(touched);
+    PROFILE_DRAW(startX, startY, height);
+}
+
+//Computed goto needs the GNU labels-as-values extension
+#if !defined(CHIP8_NO_COMPUTED_GOTO) && (defined(__GNUC__) || defined(__clang__))
+#define CHIP8_COMPUTED_GOTO 1
+#else
+#define CHIP8_COMPUTED_GOTO 0
+#endif
+
+template<bool Cached, typename Quirks, bool Traced>
+void Chip8::RunInterpreter(uint64_t cycles)
+{
+    static const Instruction* const table = DecodeTable();
+    Instruction* cache = Cached ? decodeCache.Get().entries : nullptr;
+    const Instruction* in;
+
+//An undecoded cache slot has no opcode yet, so traced runs read it from memory and decode it from the table
+#define TRACE_STEP() \
+    do { \
+        uint16_t raw = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF]; \
+        const Instruction& decoded = Cached && in->op == Op::Decode ? table[raw] : *in; \
+        trace->Append(static_cast<uint32_t>(executed - cycles - 1), pc, raw, I, sp, delayTimer, \
+                      WrittenRegisters(decoded), registers); \
+    } while (0)
+
+//Cached fetches index the per-address cache, which decodes on a miss
+#define FETCH() \
+    do { \
+        if (Cached) { \
+            in = &cache[pc & 0xFFF]; \
+            opcode = in->opcode; \
+        } \
+        else { \
+            opcode = memory[pc & 0xFFF] << 8 | memory[(pc + 1) & 0xFFF]; \
+            in = &table[opcode]; \
+        } \
+        PROFILE_STEP(); \
+        if (Traced) \
+            TRACE_STEP(); \
+    } while (0)
+
+#if CHIP8_COMPUTED_GOTO
+    static const void* const handlers[] = {
+#define CHIP8_OP_LABEL(name) &&op_##name,
+        CHIP8_OPS(CHIP8_OP_LABEL)
+#undef CHIP8_OP_LABEL
+    };
+
+//Each handler fetches and jumps to the next one itself
+#define OP(name) op_##name:
+#define DISPATCH() goto *handlers[static_cast<uint8_t>(in->op)]
+#define NEXT() \
+    do { \
+        if (cycles == 0) return; \
+        --cycles; \
+        FETCH(); \
+        DISPATCH(); \
+    } while (0)
+
+    NEXT();
+#else
+#define OP(name) case Op::name:
+#define DISPATCH() continue
+#define NEXT() goto next
+
+next:
+    if (cycles == 0) return;
+    --cycles;
+    FETCH();
+    for (;;) switch (in->op) {
+#endif
+
+//Skips get a predicted branch of their own, so the next fetch doesn't wait on the compare
+#define SKIP() \
+    do { \
+        pc += 4; \
+        NEXT(); \
+    } while (0)
+
+    OP(Decode)
+        if constexpr (Cached) {
+            uint16_t address = pc & 0xFFF;
+            opcode = memory[address] << 8 | memory[(address + 1) & 0xFFF];
+            cache[address] = table[opcode];
+            in = &cache[address];
+            DISPATCH(); //Same cycle, now decoded
+        }
+        NEXT();
+
+    OP(Nop)
+        pc += 2;
+        NEXT();
+
+    OP(Stall)
+        NEXT();
+
+    OP(Cls)
+        memset(gfx, 0, sizeof(gfx));
+        MarkDisplayDirty(0xFFFFFFFF);
+        pc += 2;
+        NEXT();
+
+    OP(Ret)
+        sp = (sp - 1) & 0xF;
+        pc = stack[sp] + 2;
+        NEXT();
+
+    OP(Jp)
+        //Timers and keys only change between Run() calls, so an idle loop's remaining whole iterations are skipped
+        if (in->nnn == pc || in->nnn + 4 == pc) {
+            if (unsigned length = IdleLoopLength(in->nnn)) {
+                cycles -= cycles / length * length;
+                idle = true;
+            }
+        }
+        pc = in->nnn;
+        NEXT();
+
+    OP(Call)
+        stack[sp] = pc;
+        sp = (sp + 1) & 0xF;
+        pc = in->nnn;
+        NEXT();
+
+    OP(SeImm)
+        if (registers[in->x] == in->nn)
+            SKIP();
+        pc += 2;
+        NEXT();
+
+    OP(SneImm)
+        if (registers[in->x] != in->nn)
+            SKIP();
+        pc += 2;
+        NEXT();
+
+    OP(SeReg)
+        if (registers[in->x] == registers[in->y])
+            SKIP();
+        pc += 2;
+        NEXT();
+
+    OP(LdImm)
+        registers[in->x] = in->nn;
+        pc += 2;
+        NEXT();
+
+    OP(AddImm)
+        registers[in->x] += in->nn;
+        pc += 2;
+        NEXT();
+
+    OP(LdReg)
+        registers[in->x] = registers[in->y];
+        pc += 2;
+        NEXT();
+
+    OP(Or)
+        registers[in->x] |= registers[in->y];
+        pc += 2;
+        NEXT();
+
+    OP(And)
+        registers[in->x] &= registers[in->y];
+        pc += 2;
+        NEXT();
+
+    OP(Xor)
+        registers[in->x] ^= registers[in->y];
+        pc += 2;
+        NEXT();
+
+    OP(AddReg)
+    {
+        uint16_t sum = registers[in->x] + registers[in->y];
+        registers[in->x] = sum & 0xFF;
+        registers[0xF] = sum > 0xFF;
+        pc += 2;
+        NEXT();
+    }
+
+    OP(Sub)
+    {
+        uint8_t x = registers[in->x];
+        uint8_t y = registers[in->y];
+        registers[in->x] = x - y;
+        registers[0xF] = x >= y;
+        pc += 2;
+        NEXT();
+    }
+
+    OP(Shr)
+    {
+        uint8_t y = registers[Quirks::shiftVx ? in->x : in->y];
+        registers[in->x] = y >> 1;
+        registers[0xF] = y & 0x1;
+        pc += 2;
+        NEXT();
+    }
+
+    OP(Subn)
+    {
+        uint8_t x = registers[in->x];
+        uint8_t y = registers[in->y];
+        registers[in->x] = y - x;
+        registers[0xF] = y >= x;
+        pc += 2;
+        NEXT();
+    }
+
+    OP(Shl)
+    {
+        uint8_t y = registers[Quirks::shiftVx ? in->x : in->y];
+        registers[in->x] = y << 1;
+        registers[0xF] = (y & 0x80) >> 7;
+        pc += 2;
+        NEXT();
+    }
+
+    OP(SneReg)
+        if (registers[in->x] != registers[in->y])
+            SKIP();
+        pc += 2;
+        NEXT();
+
+    OP(LdI)
+        I = in->nnn;
+        pc += 2;
+        NEXT();
+
+    OP(JpV0)
+        pc = in->nnn + registers[Quirks::jumpVx ? in->x : 0];
+        NEXT();
+
+    OP(Rnd)
+        registers[in->x] = NextRandom() & in->nn;
+        pc += 2;
+        NEXT();
+
+    OP(Drw)
+        Draw<Quirks>(in->x, in->y, in->nn & 0xF);
+        pc += 2;
+        NEXT();
+
+    OP(Skp)
+        if (keypad[registers[in->x] & 0xF])
+            SKIP();
+        pc += 2;
+        NEXT();
+
+    OP(Sknp)
+        if (!keypad[registers[in->x] & 0xF])
+            SKIP();
+        pc += 2;
+        NEXT();
+
+    OP(LdVxDt)
+        registers[in->x] = delayTimer;
+        pc += 2;
+        NEXT();
+
+    OP(LdVxK)
+    {
+        //Same press-then-release handshake as the reference interpreter
+        bool wasWaiting = waitingForKey;
+        if (!waitingForKey) {
+            for (uint8_t i = 0; i < 16; ++i) {
+                if (keypad[i]) {
+                    pressedKey = i;
+                    waitingRegister = in->x;
+                    waitingForKey = true;
+                    break;
+                }
+            }
+        }
+        else if (!keypad[pressedKey]) {
+            registers[waitingRegister] = pressedKey;
+            waitingForKey = false;
+            pressedKey = -1;
+            pc += 2;
+        }
+        //Nothing changed, so every remaining cycle would repeat this one
+        if (waitingForKey == wasWaiting) {
+            cycles = 0;
+            idle = true;
+        }
+        NEXT();
+    }
+
+    OP(LdDtVx)
+        delayTimer = registers[in->x];
+        pc += 2;
+        NEXT();
+
+    OP(LdStVx)
+        soundTimer = registers[in->x];
+        pc += 2;
+        NEXT();
+
+    OP(AddIVx)
+        I += registers[in->x];
+        pc += 2;
+        NEXT();
+
+    OP(LdFVx)
+        I = 0x50 + (5 * registers[in->x]);
+        pc += 2;
+        NEXT();
+
+    OP(LdBVx)
+    {
+        uint8_t val = registers[in->x];
+        memory[(I + 2) & 0xFFF] = val % 10;
+        memory[(I + 1) & 0xFFF] = val / 10 % 10;
+        memory[I & 0xFFF] = val / 100;
+        InvalidateCode(I, 3);
+        pc += 2;
+        NEXT();
+    }
+
+    OP(StoreRegs)
+        for (uint8_t i = 0; i <= in->x; ++i)
+            memory[(I + i) & 0xFFF] = registers[i];
+        InvalidateCode(I, in->x + 1);
+        if (Quirks::incrementI)
+            I += in->x + 1;
+        pc += 2;
+        NEXT();
+
+    OP(LoadRegs)
+        for (uint8_t i = 0; i <= in->x; ++i)
+            registers[i] = memory[(I + i) & 0xFFF];
+        if (Quirks::incrementI)
+            I += in->x + 1;
+        pc += 2;
+        NEXT();
+
+#if !CHIP8_COMPUTED_GOTO
+        case Op::Count:
+            return;
+    }
+#endif
+
+#undef OP
+#undef NEXT
+#undef SKIP
+#undef DISPATCH
+#undef FETCH
+#undef TRACE_STEP
+}
+
+template<typename Quirks>
+JitLayout Chip8::Layout() const
+{
+    auto offset = [this](const void* field) {
+        return static_cast<int32_t>(static_cast<const uint8_t*>(field) - reinterpret_cast<const uint8_t*>(this));
+    };
+
+    JitLayout layout;
+    layout.step = &Chip8::JitStep<Quirks>;
+    layout.draw = &Chip8::JitDraw<Quirks>;
+    layout.invalidate = &Chip8::JitInvalidate;
+    layout.clear = &Chip8::JitClear;
+    layout.shiftVx = Quirks::shiftVx;
+    layout.incrementI = Quirks::incrementI;
+    layout.memory = offset(memory);
+    layout.registers = offset(registers);
+    layout.stack = offset(stack);
+    layout.keypad = offset(keypad);
+    layout.pc = offset(&pc);
+    layout.opcode = offset(&opcode);
+    layout.I = offset(&I);
+    layout.sp = offset(&sp);
+    layout.delayTimer = offset(&delayTimer);
+    layout.soundTimer = offset(&soundTimer);
+    layout.budget = offset(&jitBudget);
+    return layout;
+}
+
+template<typename Quirks>
+void Chip8::JitStep(Chip8* self)
+{
+    self->RunInterpreter<false, Quirks>(1);
+}
+
+template<typename Quirks>
+void Chip8::JitDraw(Chip8* self, uint32_t x, uint32_t y, uint32_t height)
+{
+    self->Draw<Quirks>(x, y, height);
+}
+
+void Chip8::JitInvalidate(Chip8* self, uint32_t address, uint32_t length)
+{
+    self->InvalidateCode(address, length);
+}
+
+void Chip8::JitClear(Chip8* self)
+{
+    memset(self->gfx, 0, sizeof(self->gfx));
+    self->MarkDisplayDirty(0xFFFFFFFF);
+}
+
+template<typename Quirks>
+void Chip8::RunJit(uint64_t cycles)
+{
+    JitCache& cache = jit.Get();
+    if (!cache.Available()) {
+        RunInterpreter<true, Quirks>(cycles);
+        return;
+    }
+
+    JitLayout layout = Layout<Quirks>();
+    while (cycles > 0) {
+        //Idle loops are cut short here as in the interpreter, the 1NNN closing one ends its own block
+        if (pc < 4095 && (memory[pc] & 0xF0) == 0x10) {
+            uint16_t target = (memory[pc] & 0x0F) << 8 | memory[pc + 1];
+            if (unsigned length = IdleLoopLength(target)) {
+                opcode = 0x1000 | target;
+                pc = target;
+                --cycles;
+                cycles -= cycles / length * length;
+                idle = true;
+                continue;
+            }
+        }
+
+        //Chained blocks run until one can't be entered: uncompiled, an idle loop jump or longer than the budget left
+        if (pc < 4096) {
+            const JitCache::Block& block = cache.Lookup(pc, memory, layout);
+            if (block.fn) {
+                if (block.length > cycles) {
+                    RunInterpreter<true, Quirks>(cycles); //Blocks run whole, the decode cache finishes the budget
+                    return;
+                }
+                jitBudget = cycles;
+                block.fn(this);
+                cycles = jitBudget;
+                continue;
+            }
+        }
+        bool wasIdle = idle;
+        idle = false;
+        RunInterpreter<true, Quirks>(1);
+        --cycles;
+        if (idle)
+            cycles = 0; //An FX0A wait that saw no change, the rest of the budget would repeat it
+        idle = idle || wasIdle;
+    }
+}
+
+//Instructions in the idle loop that the 1NNN at pc closes by jumping to target, 0 if it isn't one
+//Matches a jump to itself and an FX07 / 3XNN or 4XNN / 1NNN delay timer poll that won't exit at the current timer value
+unsigned Chip8::IdleLoopLength(uint16_t target) const
+{
+    if (target == pc)
+        return 1;
+    if (target + 4 != pc || pc > 4094)
+        return 0;
+
+    uint16_t read = memory[target] << 8 | memory[target + 1];
+    uint16_t test = memory[target + 2] << 8 | memory[target + 3];
+    if ((read & 0xF0FF) != 0xF007 || (test & 0x0F00) != (read & 0x0F00))
+        return 0;
+    //A tick since the last FX07 means the next iteration still changes VX
+    if (registers[(read & 0x0F00) >> 8] != delayTimer)
+        return 0;
+
+    uint8_t nn = test & 0xFF;
+    if ((test & 0xF000) == 0x3000)
+        return delayTimer != nn ? 3 : 0;
+    if ((test & 0xF000) == 0x4000)
+        return delayTimer == nn ? 3 : 0;
+    return 0;
+}
+
+void Chip8::InvalidateCode(uint16_t address, uint16_t length)
+{
+    //Writes through I wrap at the end of memory, split them into the two ranges they touch
+    address &= 0xFFF;
+    if (address + length > 4096) {
+        uint16_t head = 4096 - address;
+        InvalidateCode(address, head);
+        InvalidateCode(0, std::min<uint16_t>(length - head, 4096));
+        return;
+    }
+
+    if (length > 0) {
+        uint32_t last = std::min<uint32_t>(address + length - 1, 4095);
+        for (uint32_t chunk = address >> 8; chunk <= last >> 8; ++chunk)
+            writtenChunks |= 1u << chunk;
+    }
+
+    if (JitCache* cache = jit.Peek())
+        cache->Invalidate(address, length);
+
+    DecodeCache* cache = decodeCache.Peek();
+    if (!cache)
+        return;
+
+    //The slot before the first byte holds an opcode that overlaps it, for byte 0 that is the one at 0xFFF
+    if (address == 0 && length > 0)
+        cache->entries[0xFFF].op = Op::Decode;
+    uint32_t first = address > 0 ? address - 1 : 0;
+    uint32_t last = std::min<uint32_t>(address + length, 4096);
+    for (uint32_t i = first; i < last; ++i)
+        cache->entries[i].op = Op::Decode;
+}
+
+namespace {
+
+const char STATE_MAGIC[4] = {'C', '8', 'S', 'T'};
+const uint16_t STATE_VERSION = 1;
+
+}
+
+size_t Chip8::SaveState(uint8_t* buffer, size_t size) const
+{
+    static_assert(STATE_SIZE == 8 + sizeof(memory) + sizeof(gfx) + sizeof(stack) + sizeof(registers)
+        + sizeof(pc) + sizeof(opcode) + sizeof(I) + sizeof(sp) + sizeof(delayTimer) + sizeof(soundTimer)
+        + 1 + sizeof(waitingRegister) + sizeof(pressedKey) + sizeof(rngState), "STATE_SIZE out of date");
+
+    if (size < STATE_SIZE)
+        return 0;
+
+    uint8_t* out = buffer;
+    auto put = [&out](const void* field, size_t bytes) {
+        memcpy(out, field, bytes);
+        out += bytes;
+    };
+
+    uint16_t reserved = 0;
+    uint8_t waiting = waitingForKey;
+    put(STATE_MAGIC, sizeof(STATE_MAGIC));
+    put(&STATE_VERSION, sizeof(STATE_VERSION));
+    put(&reserved, sizeof(reserved));
+
+    //Big arrays first, then the CPU registers
+    put(memory, sizeof(memory));
+    put(gfx, sizeof(gfx));
+    put(stack, sizeof(stack));
+    put(registers, sizeof(registers));
+    put(&pc, sizeof(pc));
+    put(&opcode, sizeof(opcode));
+    put(&I, sizeof(I));
+    put(&sp, sizeof(sp));
+    put(&delayTimer, sizeof(delayTimer));
+    put(&soundTimer, sizeof(soundTimer));
+    put(&waiting, sizeof(waiting));
+    put(&waitingRegister, sizeof(waitingRegister));
+    put(&pressedKey, sizeof(pressedKey));
+    put(&rngState, sizeof(rngState));
+
+    return out - buffer;
+}
+
+bool Chip8::LoadState(const uint8_t* buffer, size_t size)
+{
+    if (size < STATE_SIZE || memcmp(buffer, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0)
+        return false;
+
+    uint16_t version;
+    memcpy(&version, buffer + sizeof(STATE_MAGIC), sizeof(version));
+    if (version != STATE_VERSION)
+        return false;
+
+    const uint8_t* in = buffer + 8;
+    auto get = [&in](void* field, size_t bytes) {
+        memcpy(field, in, bytes);
+        in += bytes;
+    };
+
+    uint8_t waiting;
+    get(memory, sizeof(memory));
+    get(gfx, sizeof(gfx));
+    get(stack, sizeof(stack));
+    get(registers, sizeof(registers));
+    get(&pc, sizeof(pc));
+    get(&opcode, sizeof(opcode));
+    get(&I, sizeof(I));
+    get(&sp, sizeof(sp));
+    get(&delayTimer, sizeof(delayTimer));
+    get(&soundTimer, sizeof(soundTimer));
+    get(&waiting, sizeof(waiting));
+    get(&waitingRegister, sizeof(waitingRegister));
+    get(&pressedKey, sizeof(pressedKey));
+    get(&rngState, sizeof(rngState));
+    waitingForKey = waiting != 0;
+    //Keep a hand-edited or corrupt state inside the arrays these index
+    sp &= 0xF;
+    if (waitingForKey)
+        pressedKey &= 0xF;
+    waitingRegister &= 0xF;
+
+    InvalidateCode(0, 4096);
+    MarkDisplayDirty(0xFFFFFFFF);
+    return true;
+}
+
+bool Chip8::SaveStateFile(const std::filesystem::path& filename) const
+{
+    uint8_t buffer[STATE_SIZE];
+    size_t size = SaveState(buffer, sizeof(buffer));
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+    file.write(reinterpret_cast<const char*>(buffer), size);
+    return file.good();
+}
+
+bool Chip8::LoadStateFile(const std::filesystem::path& filename)
+{
+    uint8_t buffer[STATE_SIZE];
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(buffer), sizeof(buffer)))
+        return false;
+    return LoadState(buffer, sizeof(buffer));
+}
+
+uint64_t Chip8::DisplayHash() const
+{
+    //FNV-1a over the framebuffer, used to compare runs without a window
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int row = 0; row < 32; ++row) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            hash ^= (gfx[row] >> shift) & 0xFF;
+            hash *= 0x100000001B3ULL;
+        }
+    }
+    return hash;
+}
+
+void Chip8::ExpandDisplay(uint32_t* out, uint32_t onColor, uint32_t offColor, int firstRow, int rowCount) const
+{
+    ExpandRows(gfx, out, onColor, offColor, firstRow, rowCount);
+}
+
+void Chip8::ExpandRows(const uint64_t* rows, uint32_t* out, uint32_t onColor, uint32_t offColor, int firstRow, int rowCount)
+{
+    uint32_t flip = onColor ^ offColor;
+    for (int row = firstRow; row < firstRow + rowCount; ++row) {
+        uint64_t line = rows[row];
+        for (int col = 0; col < 64; ++col) {
+            //All ones mask for a lit pixel, so no branch per pixel
+            uint32_t lit = 0u - static_cast<uint32_t>((line >> (63 - col)) & 1);
+            *out++ = offColor ^ (flip & lit);
+        }
+    }
+}
+
+void Chip8::ExpandDisplay(uint8_t* out) const
+{
+    for (int row = 0; row < 32; ++row) {
+        uint64_t line = gfx[row];
+        for (int col = 0; col < 64; ++col)
+            *out++ = (line >> (63 - col)) & 1;
+    }
+}
+
 void Chip8::TickTimers() {
     //Update timers
     if(delayTimer > 0)
         --delayTimer;
     
+    //The tone plays while soundTimer > 0, frontends poll SoundActive()
     if(soundTimer > 0)
-        {
-            if(soundTimer == 1)
-                //Will add sound logic
-                printf("Beep\n");
-            --soundTimer;
-        }
+        --soundTimer;
 }
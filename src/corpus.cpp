@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chip8.hpp>
+#include <keyscript.hpp>
+#include <quirks.hpp>
+#include <rom_cache.hpp>
+#include <runner.hpp>
+#include <thread_pool.hpp>
+
+const uint64_t DEFAULT_CYCLES = 600 * 15; //10 seconds of guest time at 15 instructions per frame
+const uint64_t DEFAULT_INSTRUCTIONS_PER_FRAME = 15;
+
+struct Job {
+     std::filesystem::path romPath;
+     std::filesystem::path keysPath; //Empty for no input
+     uint64_t cycles;
+};
+
+struct Result {
+     bool ok = false;
+     std::string error;
+     uint64_t cycles = 0;
+     uint64_t frames = 0;
+     double seconds = 0.0;
+     uint64_t hash = 0;
+     QuirkProfile quirks = QuirkProfile::Chip8;
+};
+
+static void PrintUsage(const char* program)
+{
+     std::cerr << "Usage: " << program << " <ROM directory | manifest> [options]\n"
+               << "  --cycles N     Default cycle budget per ROM (default " << DEFAULT_CYCLES << ")\n"
+               << "  --ipf N        Instructions per frame (default " << DEFAULT_INSTRUCTIONS_PER_FRAME << ")\n"
+               << "  --threads N    Worker threads (default: all cores)\n"
+               << "  --engine E     switch, table, cached or jit (default table)\n"
+               << "  --quirks Q     Quirk profile for every ROM: chip8, vip, chip48 or schip (default from\n"
+               << "                 the quirks.txt beside each ROM, else chip8)\n"
+               << "  --report FILE  Write results as .json or .csv (default: CSV on stdout)\n"
+               << "Manifest lines: <rom> [cycles] [key script], paths relative to the manifest, '#' comments\n";
+}
+
+static bool ParseCount(const char* text, uint64_t& out)
+{
+     char* end = nullptr;
+     out = std::strtoull(text, &end, 10);
+     return *text != '\0' && *end == '\0';
+}
+
+static bool LoadJobs(const std::filesystem::path& source, uint64_t defaultCycles, std::vector<Job>& jobs)
+{
+     if (std::filesystem::is_directory(source)) {
+          for (const auto& entry : std::filesystem::recursive_directory_iterator(source)) {
+               std::string extension = entry.path().extension().string();
+               if (entry.is_regular_file() && (extension == ".ch8" || extension == ".rom"))
+                    jobs.push_back({entry.path(), {}, defaultCycles});
+          }
+          //Directory order is unspecified, keep reports stable between runs
+          std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) { return a.romPath < b.romPath; });
+          return true;
+     }
+
+     std::ifstream manifest(source);
+     if (!manifest.is_open())
+          return false;
+
+     std::filesystem::path base = source.parent_path();
+     std::string line;
+     while (std::getline(manifest, line)) {
+          size_t hash = line.find('#');
+          if (hash != std::string::npos)
+               line.erase(hash);
+
+          std::istringstream fields(line);
+          std::string rom, cycles, keys;
+          if (!(fields >> rom))
+               continue;
+          fields >> cycles >> keys;
+
+          Job job{base / rom, {}, defaultCycles};
+          if (!cycles.empty() && !ParseCount(cycles.c_str(), job.cycles))
+               return false;
+          if (!keys.empty())
+               job.keysPath = base / keys;
+          jobs.push_back(job);
+     }
+     return true;
+}
+
+//Runs on a worker thread, everything it touches is local except its own result slot
+//quirks is the --quirks profile, null to look each ROM up in its quirks.txt as the emulator does
+static void RunJob(const Job& job, uint64_t instructionsPerFrame, Engine engine, const QuirkProfile* quirks, Result& result)
+{
+     if (!std::filesystem::is_regular_file(job.romPath)) {
+          result.error = "ROM not found";
+          return;
+     }
+
+     KeyScript keys;
+     if (!job.keysPath.empty() && !keys.Load(job.keysPath)) {
+          result.error = "key script not readable";
+          return;
+     }
+
+     std::shared_ptr<const RomImage> image = RomCache::Shared().Load(job.romPath);
+     if (!image) {
+          result.error = "ROM unreadable or larger than 3584 bytes";
+          return;
+     }
+     result.quirks = quirks ? *quirks : LookupQuirks(job.romPath, image->Hash());
+
+     Chip8 chip8;
+     chip8.Initialize();
+     chip8.LoadImage(*image);
+     chip8.SetEngine(engine);
+     chip8.SetQuirks(result.quirks);
+
+     auto start = std::chrono::steady_clock::now();
+     result.frames = RunFrames(chip8, job.cycles, instructionsPerFrame, [&](uint64_t frame) { keys.Apply(frame, chip8.keypad); });
+     result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+     result.cycles = job.cycles;
+     result.hash = chip8.DisplayHash();
+     result.ok = true;
+}
+
+static std::string JsonEscape(const std::string& text)
+{
+     std::string out;
+     for (char c : text) {
+          if (c == '"' || c == '\\') {
+               out += '\\';
+               out += c;
+          }
+          else if (static_cast<unsigned char>(c) < 0x20) {
+               char escaped[8];
+               std::snprintf(escaped, sizeof(escaped), "\\u%04X", static_cast<unsigned>(c));
+               out += escaped;
+          }
+          else
+               out += c;
+     }
+     return out;
+}
+
+//Quoted, with embedded quotes doubled, so commas and line breaks in paths stay inside the field
+static std::string CsvField(const std::string& text)
+{
+     std::string out = "\"";
+     for (char c : text) {
+          if (c == '"')
+               out += '"';
+          out += c;
+     }
+     return out + '"';
+}
+
+static void WriteCsv(std::ostream& out, const std::vector<Job>& jobs, const std::vector<Result>& results)
+{
+     out << "rom,status,quirks,cycles,frames,wall_ms,hash\n";
+     for (size_t i = 0; i < jobs.size(); ++i) {
+          const Result& r = results[i];
+          out << CsvField(jobs[i].romPath.string()) << ',' << CsvField(r.ok ? "ok" : r.error) << ',' << QuirkProfileName(r.quirks) << ','
+              << r.cycles << ',' << r.frames << ',' << std::fixed << std::setprecision(3) << r.seconds * 1000.0 << ','
+              << "0x" << std::hex << std::setw(16) << std::setfill('0') << r.hash << std::dec << std::setfill(' ') << '\n';
+     }
+}
+
+static void WriteJson(std::ostream& out, const std::vector<Job>& jobs, const std::vector<Result>& results, double wallSeconds, size_t threads)
+{
+     out << "{\n  \"threads\": " << threads << ",\n  \"wall_ms\": " << std::fixed << std::setprecision(3) << wallSeconds * 1000.0
+         << ",\n  \"jobs\": [\n";
+     for (size_t i = 0; i < jobs.size(); ++i) {
+          const Result& r = results[i];
+          out << "    {\"rom\": \"" << JsonEscape(jobs[i].romPath.string()) << "\", \"status\": \"" << (r.ok ? "ok" : JsonEscape(r.error))
+              << "\", \"quirks\": \"" << QuirkProfileName(r.quirks) << "\", \"cycles\": " << r.cycles << ", \"frames\": " << r.frames
+              << ", \"wall_ms\": " << r.seconds * 1000.0
+              << ", \"hash\": \"0x" << std::hex << std::setw(16) << std::setfill('0') << r.hash << std::dec << std::setfill(' ') << "\"}"
+              << (i + 1 < jobs.size() ? ",\n" : "\n");
+     }
+     out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+
+     if (argc < 2) {
+          PrintUsage(argv[0]);
+          return 1;
+     }
+
+     std::filesystem::path source = argv[1];
+     std::filesystem::path reportPath;
+     uint64_t defaultCycles = DEFAULT_CYCLES;
+     uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+     uint64_t threads = std::max(1u, std::thread::hardware_concurrency());
+     Engine engine = Engine::Table;
+     QuirkProfile quirks = QuirkProfile::Chip8;
+     bool quirksGiven = false; //Otherwise looked up per ROM
+
+     for (int i = 2; i < argc; ++i) {
+          std::string arg = argv[i];
+          bool hasValue = i + 1 < argc;
+
+          if (arg == "--cycles" && hasValue && ParseCount(argv[i + 1], defaultCycles))
+               ++i;
+          else if (arg == "--ipf" && hasValue && ParseCount(argv[i + 1], instructionsPerFrame) && instructionsPerFrame > 0)
+               ++i;
+          else if (arg == "--threads" && hasValue && ParseCount(argv[i + 1], threads) && threads > 0)
+               ++i;
+          else if (arg == "--report" && hasValue)
+               reportPath = argv[++i];
+          else if (arg == "--engine" && hasValue) {
+               std::string name = argv[++i];
+               if (name == "switch") engine = Engine::Switch;
+               else if (name == "table") engine = Engine::Table;
+               else if (name == "cached") engine = Engine::Cached;
+               else if (name == "jit") engine = Engine::Jit;
+               else {
+                    std::cerr << "Unknown engine: " << name << std::endl;
+                    return 1;
+               }
+          }
+          else if (arg == "--quirks" && hasValue) {
+               if (!ParseQuirkProfile(argv[++i], quirks)) {
+                    std::cerr << "Unknown quirk profile: " << argv[i] << std::endl;
+                    return 1;
+               }
+               quirksGiven = true;
+          }
+          else {
+               PrintUsage(argv[0]);
+               return 1;
+          }
+     }
+
+     std::vector<Job> jobs;
+     if (!LoadJobs(source, defaultCycles, jobs)) {
+          std::cerr << "Could not read ROM list: " << source << std::endl;
+          return 1;
+     }
+
+     //One slot per job, so workers never write the same memory
+     std::vector<Result> results(jobs.size());
+     auto start = std::chrono::steady_clock::now();
+     {
+          WorkStealingPool pool(threads);
+          for (size_t i = 0; i < jobs.size(); ++i) {
+               pool.Submit([&, i](size_t) { RunJob(jobs[i], instructionsPerFrame, engine, quirksGiven ? &quirks : nullptr, results[i]); });
+          }
+          pool.Wait();
+     }
+     double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+     size_t failed = std::count_if(results.begin(), results.end(), [](const Result& r) { return !r.ok; });
+     uint64_t totalCycles = 0;
+     for (const Result& r : results)
+          totalCycles += r.cycles;
+
+     if (reportPath.empty())
+          WriteCsv(std::cout, jobs, results);
+     else {
+          std::ofstream report(reportPath);
+          if (!report.is_open()) {
+               std::cerr << "Could not write report: " << reportPath << std::endl;
+               return 1;
+          }
+          if (reportPath.extension() == ".json")
+               WriteJson(report, jobs, results, wallSeconds, threads);
+          else
+               WriteCsv(report, jobs, results);
+     }
+
+     std::cerr << jobs.size() << " jobs, " << failed << " failed, " << threads << " threads, "
+               << wallSeconds << " s, " << static_cast<uint64_t>(totalCycles / std::max(wallSeconds, 1e-9)) << " instructions/sec" << std::endl;
+     return failed ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+#include <decode.hpp>
+#include <cstdio>
+
+Instruction DecodeOpcode(uint16_t opcode)
+{
+    Instruction in{};
+    in.x = (opcode & 0x0F00) >> 8;
+    in.y = (opcode & 0x00F0) >> 4;
+    in.nn = opcode & 0x00FF;
+    in.nnn = opcode & 0x0FFF;
+    in.opcode = opcode;
+
+    //Same masks as the reference switch, so unknown opcodes behave identically
+    switch (opcode & 0xF000)
+    {
+        case 0x0000:
+            if (in.nn == 0xE0) in.op = Op::Cls;
+            else if (in.nn == 0xEE) in.op = Op::Ret;
+            else in.op = Op::Nop;
+            break;
+
+        case 0x1000: in.op = Op::Jp; break;
+        case 0x2000: in.op = Op::Call; break;
+        case 0x3000: in.op = Op::SeImm; break;
+        case 0x4000: in.op = Op::SneImm; break;
+        case 0x5000: in.op = Op::SeReg; break;
+        case 0x6000: in.op = Op::LdImm; break;
+        case 0x7000: in.op = Op::AddImm; break;
+
+        case 0x8000:
+            switch (opcode & 0x000F)
+            {
+                case 0x0: in.op = Op::LdReg; break;
+                case 0x1: in.op = Op::Or; break;
+                case 0x2: in.op = Op::And; break;
+                case 0x3: in.op = Op::Xor; break;
+                case 0x4: in.op = Op::AddReg; break;
+                case 0x5: in.op = Op::Sub; break;
+                case 0x6: in.op = Op::Shr; break;
+                case 0x7: in.op = Op::Subn; break;
+                case 0xE: in.op = Op::Shl; break;
+                default: in.op = Op::Nop; break;
+            }
+            break;
+
+        case 0x9000: in.op = Op::SneReg; break;
+        case 0xA000: in.op = Op::LdI; break;
+        case 0xB000: in.op = Op::JpV0; break;
+        case 0xC000: in.op = Op::Rnd; break;
+        case 0xD000: in.op = Op::Drw; break;
+
+        case 0xE000:
+            if (in.nn == 0x9E) in.op = Op::Skp;
+            else if (in.nn == 0xA1) in.op = Op::Sknp;
+            else in.op = Op::Nop;
+            break;
+
+        case 0xF000:
+            switch (in.nn)
+            {
+                case 0x07: in.op = Op::LdVxDt; break;
+                case 0x0A: in.op = Op::LdVxK; break;
+                case 0x15: in.op = Op::LdDtVx; break;
+                case 0x18: in.op = Op::LdStVx; break;
+                case 0x1E: in.op = Op::AddIVx; break;
+                case 0x29: in.op = Op::LdFVx; break;
+                case 0x33: in.op = Op::LdBVx; break;
+                case 0x55: in.op = Op::StoreRegs; break;
+                case 0x65: in.op = Op::LoadRegs; break;
+                default: in.op = Op::Stall; break;
+            }
+            break;
+    }
+    return in;
+}
+
+namespace {
+
+struct Table {
+    Instruction entries[65536];
+
+    Table()
+    {
+        for (uint32_t opcode = 0; opcode < 65536; ++opcode)
+            entries[opcode] = DecodeOpcode(static_cast<uint16_t>(opcode));
+    }
+};
+
+}
+
+const Instruction* DecodeTable()
+{
+    static const Table table;
+    return table.entries;
+}
+
+const char* OpName(Op op)
+{
+    static const char* const names[] = {
+#define CHIP8_OP_NAME(name) #name,
+        CHIP8_OPS(CHIP8_OP_NAME)
+#undef CHIP8_OP_NAME
+    };
+    return op < Op::Count ? names[static_cast<uint8_t>(op)] : "Count";
+}
+
+std::string Disassemble(uint16_t opcode)
+{
+    Instruction in = DecodeOpcode(opcode);
+    char text[24];
+    auto format = [&text](const char* pattern, auto... values) {
+        std::snprintf(text, sizeof(text), pattern, values...);
+    };
+    unsigned x = in.x, y = in.y, nn = in.nn, nnn = in.nnn;
+
+    switch (in.op)
+    {
+        case Op::Cls:       return "CLS";
+        case Op::Ret:       return "RET";
+        case Op::Jp:        format("JP 0x%03X", nnn); break;
+        case Op::Call:      format("CALL 0x%03X", nnn); break;
+        case Op::SeImm:     format("SE V%X, 0x%02X", x, nn); break;
+        case Op::SneImm:    format("SNE V%X, 0x%02X", x, nn); break;
+        case Op::SeReg:     format("SE V%X, V%X", x, y); break;
+        case Op::LdImm:     format("LD V%X, 0x%02X", x, nn); break;
+        case Op::AddImm:    format("ADD V%X, 0x%02X", x, nn); break;
+        case Op::LdReg:     format("LD V%X, V%X", x, y); break;
+        case Op::Or:        format("OR V%X, V%X", x, y); break;
+        case Op::And:       format("AND V%X, V%X", x, y); break;
+        case Op::Xor:       format("XOR V%X, V%X", x, y); break;
+        case Op::AddReg:    format("ADD V%X, V%X", x, y); break;
+        case Op::Sub:       format("SUB V%X, V%X", x, y); break;
+        case Op::Shr:       format("SHR V%X, V%X", x, y); break;
+        case Op::Subn:      format("SUBN V%X, V%X", x, y); break;
+        case Op::Shl:       format("SHL V%X, V%X", x, y); break;
+        case Op::SneReg:    format("SNE V%X, V%X", x, y); break;
+        case Op::LdI:       format("LD I, 0x%03X", nnn); break;
+        case Op::JpV0:      format("JP V0, 0x%03X", nnn); break;
+        case Op::Rnd:       format("RND V%X, 0x%02X", x, nn); break;
+        case Op::Drw:       format("DRW V%X, V%X, %u", x, y, nn & 0xF); break;
+        case Op::Skp:       format("SKP V%X", x); break;
+        case Op::Sknp:      format("SKNP V%X", x); break;
+        case Op::LdVxDt:    format("LD V%X, DT", x); break;
+        case Op::LdVxK:     format("LD V%X, K", x); break;
+        case Op::LdDtVx:    format("LD DT, V%X", x); break;
+        case Op::LdStVx:    format("LD ST, V%X", x); break;
+        case Op::AddIVx:    format("ADD I, V%X", x); break;
+        case Op::LdFVx:     format("LD F, V%X", x); break;
+        case Op::LdBVx:     format("LD B, V%X", x); break;
+        case Op::StoreRegs: format("LD [I], V%X", x); break;
+        case Op::LoadRegs:  format("LD V%X, [I]", x); break;
+        default:
+            if ((opcode & 0xF000) == 0)
+                format("SYS 0x%03X", nnn);
+            else
+                format("DW 0x%04X", static_cast<unsigned>(opcode));
+            break;
+    }
+    return text;
+}
@@ -0,0 +1,99 @@
+#include <fork.hpp>
+#include <cstring>
+
+ForkNode::ForkNode(const Chip8& machine)
+{
+    CaptureCpu(machine);
+    for (size_t chunk = 0; chunk < CHUNKS; ++chunk) {
+        auto copy = std::make_shared<Chunk>();
+        memcpy(copy->data(), machine.memory + chunk * CHUNK_SIZE, CHUNK_SIZE);
+        chunks[chunk] = std::move(copy);
+    }
+}
+
+ForkNode ForkNode::Fork(const Chip8& machine) const
+{
+    ForkNode child;
+    child.CaptureCpu(machine);
+    for (size_t chunk = 0; chunk < CHUNKS; ++chunk) {
+        if (machine.writtenChunks & (1u << chunk)) {
+            auto copy = std::make_shared<Chunk>();
+            memcpy(copy->data(), machine.memory + chunk * CHUNK_SIZE, CHUNK_SIZE);
+            child.chunks[chunk] = std::move(copy);
+        }
+        else {
+            child.chunks[chunk] = chunks[chunk];
+        }
+    }
+    return child;
+}
+
+void ForkNode::Restore(Chip8& machine) const
+{
+    RestoreCpu(machine);
+    for (size_t chunk = 0; chunk < CHUNKS; ++chunk)
+        RestoreChunk(machine, chunk);
+    machine.writtenChunks = 0;
+}
+
+void ForkNode::Restore(Chip8& machine, const ForkNode& loaded) const
+{
+    RestoreCpu(machine);
+    for (size_t chunk = 0; chunk < CHUNKS; ++chunk) {
+        if (chunks[chunk] != loaded.chunks[chunk] || (machine.writtenChunks & (1u << chunk)))
+            RestoreChunk(machine, chunk);
+    }
+    machine.writtenChunks = 0;
+}
+
+size_t ForkNode::SharedChunks(const ForkNode& other) const
+{
+    size_t shared = 0;
+    for (size_t chunk = 0; chunk < CHUNKS; ++chunk)
+        shared += chunks[chunk] == other.chunks[chunk];
+    return shared;
+}
+
+void ForkNode::RestoreChunk(Chip8& machine, size_t chunk) const
+{
+    uint16_t address = static_cast<uint16_t>(chunk * CHUNK_SIZE);
+    memcpy(machine.memory + address, chunks[chunk]->data(), CHUNK_SIZE);
+    machine.InvalidateCode(address, CHUNK_SIZE);
+}
+
+void ForkNode::CaptureCpu(const Chip8& machine)
+{
+    memcpy(gfx, machine.gfx, sizeof(gfx));
+    memcpy(stack, machine.stack, sizeof(stack));
+    memcpy(registers, machine.registers, sizeof(registers));
+    memcpy(keypad, machine.keypad, sizeof(keypad));
+    pc = machine.pc;
+    opcode = machine.opcode;
+    I = machine.I;
+    sp = machine.sp;
+    delayTimer = machine.delayTimer;
+    soundTimer = machine.soundTimer;
+    waitingForKey = machine.waitingForKey;
+    waitingRegister = machine.waitingRegister;
+    pressedKey = machine.pressedKey;
+    rngState = machine.rngState;
+}
+
+void ForkNode::RestoreCpu(Chip8& machine) const
+{
+    memcpy(machine.gfx, gfx, sizeof(gfx));
+    memcpy(machine.stack, stack, sizeof(stack));
+    memcpy(machine.registers, registers, sizeof(registers));
+    memcpy(machine.keypad, keypad, sizeof(keypad));
+    machine.pc = pc;
+    machine.opcode = opcode;
+    machine.I = I;
+    machine.sp = sp;
+    machine.delayTimer = delayTimer;
+    machine.soundTimer = soundTimer;
+    machine.waitingForKey = waitingForKey;
+    machine.waitingRegister = waitingRegister;
+    machine.pressedKey = pressedKey;
+    machine.rngState = rngState;
+    machine.MarkDisplayDirty(0xFFFFFFFF);
+}
@@ -0,0 +1,273 @@
+#include <frame_capture.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+const int MAX_SCALE = 16;
+const size_t STORED_BLOCK = 65535; //Largest uncompressed deflate block
+
+void PutBE32(std::vector<uint8_t>& out, uint32_t value)
+{
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static const auto table = [] {
+        std::array<uint32_t, 256> entries{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int bit = 0; bit < 8; ++bit)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+        return entries;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t Adler32(const uint8_t* data, size_t size)
+{
+    uint32_t a = 1;
+    uint32_t b = 0;
+    for (size_t i = 0; i < size; ++i) {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+//Length, type, data, then the CRC of type and data
+void PutChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+{
+    PutBE32(out, static_cast<uint32_t>(size));
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+    PutBE32(out, Crc32(out.data() + start, out.size() - start));
+}
+
+uint8_t Clamp(double value)
+{
+    return static_cast<uint8_t>(std::clamp(value + 0.5, 0.0, 255.0));
+}
+
+}
+
+FrameCapture::FrameCapture(uint32_t onColor, uint32_t offColor, int scale)
+    : onColor(onColor),
+      offColor(offColor),
+      scale(std::clamp(scale, 1, MAX_SCALE)),
+      width(64 * this->scale),
+      height(32 * this->scale)
+{
+    const uint32_t colors[2] = {offColor, onColor};
+    for (int i = 0; i < 2; ++i) {
+        double r = (colors[i] >> 24) & 0xFF;
+        double g = (colors[i] >> 16) & 0xFF;
+        double b = (colors[i] >> 8) & 0xFF;
+        yuv[i][0] = Clamp(16.0 + (65.481 * r + 128.553 * g + 24.966 * b) / 255.0);
+        yuv[i][1] = Clamp(128.0 + (-37.797 * r - 74.203 * g + 112.0 * b) / 255.0);
+        yuv[i][2] = Clamp(128.0 + (112.0 * r - 93.786 * g - 18.214 * b) / 255.0);
+    }
+}
+
+FrameCapture::~FrameCapture()
+{
+    Close();
+}
+
+bool FrameCapture::Open(const std::filesystem::path& filepath)
+{
+    if (writer.joinable())
+        return false;
+
+    path = filepath;
+    if (path.extension() == ".png") {
+        format = Format::Png;
+        std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : ".";
+        if (!std::filesystem::is_directory(directory)) {
+            std::cerr << "Capture directory does not exist: " << directory << std::endl;
+            return false;
+        }
+    }
+    else {
+        format = path.extension() == ".y4m" ? Format::Y4m : Format::Raw;
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Could not create capture file: " << path << std::endl;
+            return false;
+        }
+        if (format == Format::Y4m)
+            file << "YUV4MPEG2 W" << width << " H" << height << " F60:1 Ip A1:1 C444\n";
+    }
+
+    indices.resize(static_cast<size_t>(width) * height);
+    output.reserve(static_cast<size_t>(width) * height * 4);
+    failed = false;
+    stopping.store(false);
+    writer = std::thread(&FrameCapture::WriterLoop, this);
+    return true;
+}
+
+void FrameCapture::Submit(const uint64_t* rows)
+{
+    if (!writer.joinable())
+        return;
+
+    ++submitted;
+    Frame frame;
+    std::copy(rows, rows + frame.size(), frame.begin());
+    if (!queue.TryPush(frame))
+        ++dropped;
+}
+
+bool FrameCapture::Close()
+{
+    if (!writer.joinable())
+        return !failed;
+
+    stopping.store(true, std::memory_order_release);
+    writer.join();
+    if (file.is_open()) {
+        file.close();
+        failed |= file.fail();
+    }
+    if (failed)
+        std::cerr << "Could not write capture to " << path << std::endl;
+    return !failed;
+}
+
+void FrameCapture::WriterLoop()
+{
+    Frame frame;
+    while (true) {
+        //Everything pushed before the stop request is visible once it is seen
+        bool stop = stopping.load(std::memory_order_acquire);
+        while (queue.TryPop(frame)) {
+            if (failed)
+                continue; //Keep draining so the producer isn't stuck dropping frames
+            if (WriteFrame(frame))
+                written.fetch_add(1, std::memory_order_relaxed);
+            else
+                failed = true;
+        }
+        if (stop)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void FrameCapture::ExpandIndices(const Frame& frame)
+{
+    uint8_t* out = indices.data();
+    for (uint64_t row : frame) {
+        uint8_t* line = out;
+        for (int x = 0; x < 64; ++x) {
+            uint8_t on = (row >> (63 - x)) & 1;
+            std::fill_n(out, scale, on);
+            out += scale;
+        }
+        for (int copy = 1; copy < scale; ++copy) {
+            std::memcpy(out, line, width);
+            out += width;
+        }
+    }
+}
+
+bool FrameCapture::WriteFrame(const Frame& frame)
+{
+    ExpandIndices(frame);
+    if (format == Format::Png)
+        return WritePng();
+
+    output.clear();
+    if (format == Format::Y4m) {
+        const char header[] = "FRAME\n";
+        output.insert(output.end(), header, header + sizeof(header) - 1);
+        for (int plane = 0; plane < 3; ++plane) {
+            for (uint8_t index : indices)
+                output.push_back(yuv[index][plane]);
+        }
+    }
+    else {
+        for (uint8_t index : indices) {
+            uint32_t color = index ? onColor : offColor;
+            PutBE32(output, color); //RGBA8888 is R in the top byte
+        }
+    }
+
+    file.write(reinterpret_cast<const char*>(output.data()), output.size());
+    return file.good();
+}
+
+//Palette PNG at bit depth 1, so a pixel is its index bit, with the image data in stored deflate blocks.
+//Compressing would cost more than the write for frames this small.
+bool FrameCapture::WritePng()
+{
+    //Scanlines: filter type 0, then the indices packed MSB first
+    //output holds them until they are copied into zlib, then the file
+    size_t rowBytes = (width + 7) / 8;
+    std::vector<uint8_t>& raw = output;
+    raw.assign(height * (rowBytes + 1), 0);
+    for (int y = 0; y < height; ++y) {
+        uint8_t* line = raw.data() + y * (rowBytes + 1) + 1;
+        const uint8_t* source = indices.data() + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; ++x)
+            line[x >> 3] |= source[x] << (7 - (x & 7));
+    }
+
+    zlib.clear();
+    zlib.push_back(0x78); //Deflate, 32 KB window
+    zlib.push_back(0x01); //No preset dictionary, check bits
+    for (size_t offset = 0; offset < raw.size(); offset += STORED_BLOCK) {
+        size_t length = std::min(STORED_BLOCK, raw.size() - offset);
+        zlib.push_back(offset + length == raw.size() ? 1 : 0); //BFINAL, BTYPE 00
+        zlib.push_back(static_cast<uint8_t>(length));
+        zlib.push_back(static_cast<uint8_t>(length >> 8));
+        zlib.push_back(static_cast<uint8_t>(~length));
+        zlib.push_back(static_cast<uint8_t>(~length >> 8));
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+    }
+    PutBE32(zlib, Adler32(raw.data(), raw.size()));
+
+    //Bit depth 1, palette color, default methods, no interlace
+    uint8_t header[13] = {0, 0, static_cast<uint8_t>(width >> 8), static_cast<uint8_t>(width),
+                          0, 0, static_cast<uint8_t>(height >> 8), static_cast<uint8_t>(height), 1, 3, 0, 0, 0};
+    const uint32_t colors[2] = {offColor, onColor};
+    uint8_t palette[6];
+    for (int i = 0; i < 2; ++i) {
+        palette[i * 3] = static_cast<uint8_t>(colors[i] >> 24);
+        palette[i * 3 + 1] = static_cast<uint8_t>(colors[i] >> 16);
+        palette[i * 3 + 2] = static_cast<uint8_t>(colors[i] >> 8);
+    }
+
+    std::vector<uint8_t>& png = output;
+    png.clear();
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    png.insert(png.end(), signature, signature + 8);
+    PutChunk(png, "IHDR", header, sizeof(header));
+    PutChunk(png, "PLTE", palette, sizeof(palette));
+    PutChunk(png, "IDAT", zlib.data(), zlib.size());
+    PutChunk(png, "IEND", nullptr, 0);
+
+    char number[16];
+    std::snprintf(number, sizeof(number), "_%06llu.png", static_cast<unsigned long long>(written.load(std::memory_order_relaxed)));
+    std::filesystem::path framePath = path;
+    framePath.replace_filename(path.stem().string() + number);
+
+    std::ofstream frameFile(framePath, std::ios::binary | std::ios::trunc);
+    frameFile.write(reinterpret_cast<const char*>(png.data()), png.size());
+    return frameFile.good();
+}
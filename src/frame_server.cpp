@@ -0,0 +1,373 @@
+#include <frame_server.hpp>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_FRAME_SERVER 1
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#else
+#define CHIP8_FRAME_SERVER 0
+#endif
+
+using namespace FrameProtocol;
+
+namespace {
+
+#if CHIP8_FRAME_SERVER
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL; //A client that hung up is an error return, not SIGPIPE
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+bool SocketAddress(const std::filesystem::path& socketPath, sockaddr_un& address)
+{
+    std::string path = socketPath.string();
+    address = {};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is empty or too long: " << path << std::endl;
+        return false;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+bool ReadAll(int fd, void* data, size_t size)
+{
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t got = read(fd, bytes, size);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        bytes += got;
+        size -= got;
+    }
+    return true;
+}
+
+bool SendAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = send(fd, bytes, size, SEND_FLAGS);
+        if (sent < 0 && errno == EINTR)
+            continue;
+        if (sent <= 0)
+            return false;
+        bytes += sent;
+        size -= sent;
+    }
+    return true;
+}
+#endif
+
+}
+
+FrameServer::FrameServer(Chip8& machine, uint64_t instructionsPerFrame)
+    : machine(machine), instructionsPerFrame(instructionsPerFrame)
+{
+}
+
+FrameServer::~FrameServer()
+{
+    Close();
+}
+
+bool FrameServer::Listen(const std::filesystem::path& socketPath)
+{
+#if CHIP8_FRAME_SERVER
+    sockaddr_un address;
+    if (!SocketAddress(socketPath, address))
+        return false;
+
+    Close();
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        std::cerr << "Could not create socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    unlink(address.sun_path);
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 1) != 0) {
+        std::cerr << "Could not listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        close(listener);
+        listener = -1;
+        return false;
+    }
+    path = socketPath;
+    return true;
+#else
+    (void)socketPath;
+    std::cerr << "The frame server needs Unix domain sockets" << std::endl;
+    return false;
+#endif
+}
+
+void FrameServer::Close()
+{
+#if CHIP8_FRAME_SERVER
+    if (listener < 0)
+        return;
+    close(listener);
+    listener = -1;
+    unlink(path.c_str());
+#endif
+}
+
+bool FrameServer::Serve()
+{
+#if CHIP8_FRAME_SERVER
+    while (listener >= 0) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR)
+                continue;
+            std::cerr << "Could not accept a client: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        //A new client has nothing on screen yet
+        std::memset(sent, 0, sizeof(sent));
+        Request request;
+        bool quit = false;
+        while (!quit && ReadAll(client, &request, sizeof(request))) {
+            ++requests;
+            if (!Handle(client, request, quit))
+                break;
+        }
+        close(client);
+        if (quit)
+            return true;
+    }
+#endif
+    return false;
+}
+
+bool FrameServer::Handle(int client, const Request& request, bool& quit)
+{
+    if (request.format > Format::Rgba) {
+        std::cerr << "Frame server: unknown format " << static_cast<int>(request.format) << std::endl;
+        return false;
+    }
+
+    switch (request.command) {
+    case Command::Key:
+        machine.keypad[request.key & 0xF] = request.down ? 1 : 0;
+        return true;
+    case Command::Step:
+        for (uint32_t i = 0; i < request.frames; ++i) {
+            machine.Run(instructionsPerFrame);
+            machine.TickTimers();
+            ++frame;
+            if (!SendUpdate(client, request.format))
+                return false;
+        }
+        return true;
+    case Command::Run:
+        for (uint32_t i = 0; i < request.frames; ++i) {
+            machine.Run(instructionsPerFrame);
+            machine.TickTimers();
+        }
+        frame += request.frames;
+        return SendUpdate(client, request.format);
+    case Command::Sync:
+        std::memset(sent, 0, sizeof(sent));
+        return SendUpdate(client, request.format);
+    case Command::Quit:
+        quit = true;
+        return true;
+    }
+    std::cerr << "Frame server: unknown command " << static_cast<int>(request.command) << std::endl;
+    return false;
+}
+
+bool FrameServer::SendUpdate(int client, Format format)
+{
+#if CHIP8_FRAME_SERVER
+    uint8_t* payload = message + sizeof(Update);
+    uint32_t rowMask = 0;
+    size_t payloadBytes = 0;
+
+    switch (format) {
+    case Format::Delta:
+        for (int row = 0; row < 32; ++row) {
+            uint64_t changed = machine.gfx[row] ^ sent[row];
+            if (changed) {
+                std::memcpy(payload + payloadBytes, &changed, sizeof(changed));
+                payloadBytes += sizeof(changed);
+                rowMask |= 1u << row;
+            }
+        }
+        break;
+    case Format::Rows:
+        std::memcpy(payload, machine.gfx, sizeof(machine.gfx));
+        payloadBytes = sizeof(machine.gfx);
+        rowMask = 0xFFFFFFFF;
+        break;
+    case Format::Rgba:
+        machine.ExpandDisplay(reinterpret_cast<uint32_t*>(payload), ON_COLOR, OFF_COLOR);
+        payloadBytes = MAX_PAYLOAD;
+        rowMask = 0xFFFFFFFF;
+        break;
+    }
+    std::memcpy(sent, machine.gfx, sizeof(sent));
+
+    Update header{};
+    header.frame = frame;
+    header.rowMask = rowMask;
+    header.payloadBytes = static_cast<uint16_t>(payloadBytes);
+    header.format = format;
+    header.flags = (machine.SoundActive() ? Update::SOUND : 0) | (machine.IsIdleUntilKey() ? Update::IDLE_UNTIL_KEY : 0);
+    std::memcpy(message, &header, sizeof(header));
+
+    size_t size = sizeof(header) + payloadBytes;
+    if (!SendAll(client, message, size))
+        return false;
+    bytesSent += size;
+    return true;
+#else
+    (void)client;
+    (void)format;
+    return false;
+#endif
+}
+
+FrameClient::~FrameClient()
+{
+    Close();
+}
+
+bool FrameClient::Connect(const std::filesystem::path& socketPath)
+{
+#if CHIP8_FRAME_SERVER
+    sockaddr_un address;
+    if (!SocketAddress(socketPath, address))
+        return false;
+
+    Close();
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        std::cerr << "Could not connect to " << socketPath << ": " << std::strerror(errno) << std::endl;
+        Close();
+        return false;
+    }
+    std::memset(rows, 0, sizeof(rows));
+    return true;
+#else
+    (void)socketPath;
+    std::cerr << "The frame server needs Unix domain sockets" << std::endl;
+    return false;
+#endif
+}
+
+void FrameClient::Close()
+{
+#if CHIP8_FRAME_SERVER
+    if (fd >= 0)
+        close(fd);
+#endif
+    fd = -1;
+}
+
+bool FrameClient::Key(uint8_t key, bool down)
+{
+    return Send({Command::Key, key, static_cast<uint8_t>(down ? 1 : 0), Format::Delta, 0});
+}
+
+bool FrameClient::Step(uint32_t frames, Format format)
+{
+    if (!Send({Command::Step, 0, 0, format, frames}))
+        return false;
+    for (uint32_t i = 0; i < frames; ++i) {
+        if (!ReceiveUpdate())
+            return false;
+    }
+    return true;
+}
+
+bool FrameClient::Run(uint32_t frames, Format format)
+{
+    return Send({Command::Run, 0, 0, format, frames}) && ReceiveUpdate();
+}
+
+bool FrameClient::Sync(Format format)
+{
+    if (!Send({Command::Sync, 0, 0, format, 0}))
+        return false;
+    std::memset(rows, 0, sizeof(rows)); //The server diffs against a blank display too
+    return ReceiveUpdate();
+}
+
+bool FrameClient::Quit()
+{
+    bool sent = Send({Command::Quit, 0, 0, Format::Delta, 0});
+    Close();
+    return sent;
+}
+
+bool FrameClient::Send(const Request& request)
+{
+#if CHIP8_FRAME_SERVER
+    return fd >= 0 && SendAll(fd, &request, sizeof(request));
+#else
+    (void)request;
+    return false;
+#endif
+}
+
+bool FrameClient::ReceiveUpdate()
+{
+#if CHIP8_FRAME_SERVER
+    Update header;
+    if (fd < 0 || !ReadAll(fd, &header, sizeof(header)))
+        return false;
+    if (header.payloadBytes > MAX_PAYLOAD || !ReadAll(fd, payload, header.payloadBytes))
+        return false;
+    bytesReceived += sizeof(header) + header.payloadBytes;
+    last = header;
+
+    switch (header.format) {
+    case Format::Delta: {
+        const uint8_t* word = payload;
+        const uint8_t* end = payload + header.payloadBytes;
+        for (int row = 0; row < 32; ++row) {
+            if (!((header.rowMask >> row) & 1))
+                continue;
+            if (word == end)
+                return false;
+            uint64_t changed;
+            std::memcpy(&changed, word, sizeof(changed));
+            rows[row] ^= changed;
+            word += sizeof(changed);
+        }
+        return word == end;
+    }
+    case Format::Rows:
+        if (header.payloadBytes != sizeof(rows))
+            return false;
+        std::memcpy(rows, payload, sizeof(rows));
+        return true;
+    case Format::Rgba: {
+        if (header.payloadBytes != MAX_PAYLOAD)
+            return false;
+        const uint32_t* pixels = reinterpret_cast<const uint32_t*>(payload);
+        for (int row = 0; row < 32; ++row) {
+            uint64_t bits = 0;
+            for (int x = 0; x < 64; ++x)
+                bits = (bits << 1) | (pixels[row * 64 + x] == ON_COLOR);
+            rows[row] = bits;
+        }
+        return true;
+    }
+    }
+    return false;
+#else
+    return false;
+#endif
+}
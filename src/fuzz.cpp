@@ -0,0 +1,867 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <batch.hpp>
+#include <chip8.hpp>
+#include <decode.hpp>
+#include <quirks.hpp>
+
+const uint64_t DEFAULT_CYCLES = 20000;
+const uint64_t DEFAULT_INTERVAL = 64;
+const uint64_t DEFAULT_RUNS = 2000;
+const uint64_t LIBFUZZER_CYCLES = 4000; //Per input, libFuzzer wants many short runs
+const uint64_t INSTRUCTIONS_PER_FRAME = 15;
+const size_t ROM_START = 0x200;
+const size_t IMAGE_SIZE = 4096;
+const Engine TESTED_ENGINES[] = {Engine::Table, Engine::Cached, Engine::Jit};
+const size_t BATCH_LANES = 8; //Chip8Batch lanes per case, each checked against its own reference
+const uint64_t BATCH_CYCLES = 5000; //Per lane, the batch steps unvectorized code several times slower
+const QuirkProfile PROFILES[] = {QuirkProfile::Chip8, QuirkProfile::Vip, QuirkProfile::Chip48, QuirkProfile::Schip};
+
+//SaveState() layout, to name the first byte that differs
+struct StateField {
+     const char* name;
+     size_t size;
+     size_t element; //Bytes per printed element, the whole field for scalars
+};
+constexpr StateField STATE_FIELDS[] = {
+     {"header", 8, 8}, {"memory", 4096, 1}, {"gfx", 256, 8}, {"stack", 32, 2}, {"V", 16, 1},
+     {"pc", 2, 2}, {"opcode", 2, 2}, {"I", 2, 2}, {"sp", 1, 1}, {"delay timer", 1, 1}, {"sound timer", 1, 1},
+     {"waiting for key", 1, 1}, {"waiting register", 1, 1}, {"pressed key", 1, 1}, {"rng", 4, 4},
+};
+constexpr size_t StateFieldsSize()
+{
+     size_t total = 0;
+     for (const StateField& field : STATE_FIELDS)
+          total += field.size;
+     return total;
+}
+static_assert(StateFieldsSize() == Chip8::STATE_SIZE, "STATE_FIELDS is out of date with Chip8::SaveState()");
+const size_t STATE_V = 8 + 4096 + 256 + 32;
+const size_t STATE_PC = STATE_V + 16;
+
+//One generated program and how to run it
+struct FuzzCase {
+     std::vector<uint8_t> image; //Loaded at 0x200, bytes past 0xFFF wrap around to 0x000
+     QuirkProfile quirks = QuirkProfile::Chip8;
+     uint64_t cycles = DEFAULT_CYCLES;
+     uint64_t interval = DEFAULT_INTERVAL; //Instructions per Run() call and state check
+};
+
+struct Divergence {
+     Engine engine;
+     int lane;           //Batch lane that differed, -1 for a single-machine engine
+     uint64_t cycle;     //Instructions run when the states first differed
+     uint64_t lastMatch; //Instructions run at the check before, where they still agreed
+     size_t offset;      //First differing byte of SaveState()
+};
+
+static const char* EngineName(Engine engine)
+{
+     switch (engine)
+     {
+          case Engine::Switch:
+               return "switch";
+          case Engine::Table:
+               return "table";
+          case Engine::Cached:
+               return "cached";
+          default:
+               return "jit";
+     }
+}
+
+static std::string TargetName(const Divergence& divergence)
+{
+     return divergence.lane >= 0 ? "batch lane " + std::to_string(divergence.lane) : EngineName(divergence.engine);
+}
+
+static uint64_t HashImage(const std::vector<uint8_t>& image) //FNV-1a, seeds CXNN and the keypad
+{
+     uint64_t hash = 0xCBF29CE484222325ULL;
+     for (uint8_t byte : image)
+          hash = (hash ^ byte) * 0x100000001B3ULL;
+     return hash;
+}
+
+static uint32_t XorShift(uint32_t& state)
+{
+     state ^= state << 13;
+     state ^= state >> 17;
+     state ^= state << 5;
+     return state;
+}
+
+static void Boot(Chip8& machine, const FuzzCase& fuzzCase, Engine engine, uint32_t seed)
+{
+     machine.Initialize();
+     uint8_t* memory = machine.GetMemory();
+     for (size_t i = 0; i < std::min(fuzzCase.image.size(), IMAGE_SIZE); ++i)
+          memory[(ROM_START + i) & 0xFFF] = fuzzCase.image[i];
+     machine.InvalidateCode(0, 4096);
+     machine.SetEngine(engine);
+     machine.SetQuirks(fuzzCase.quirks);
+     machine.SeedRandom(seed);
+}
+
+static void SetRegisters(Chip8& machine, const uint8_t* values) //Through a saved state, V is private
+{
+     uint8_t state[Chip8::STATE_SIZE];
+     machine.SaveState(state, sizeof(state));
+     std::memcpy(state + STATE_V, values, 16);
+     machine.LoadState(state, sizeof(state));
+}
+
+//The reference interpreter and the engines under test, booted from one case and run on one schedule:
+//the same slices of instructions, timer ticks every frame and keypad changes derived from the image
+class Lockstep {
+
+public:
+     Lockstep(const FuzzCase& fuzzCase, const std::vector<Engine>& engines)
+          : fuzzCase(fuzzCase), keyState(static_cast<uint32_t>(HashImage(fuzzCase.image) >> 32) | 1)
+     {
+          uint32_t seed = static_cast<uint32_t>(HashImage(fuzzCase.image));
+          machines.push_back(std::make_unique<Chip8>());
+          Boot(*machines[0], fuzzCase, Engine::Switch, seed);
+          for (Engine engine : engines) {
+               machines.push_back(std::make_unique<Chip8>());
+               Boot(*machines.back(), fuzzCase, engine, seed);
+          }
+     }
+
+     //Runs every machine to the next check, false once the case is done
+     bool Advance()
+     {
+          if (done >= fuzzCase.cycles)
+               return false;
+          uint64_t frameLeft = INSTRUCTIONS_PER_FRAME - done % INSTRUCTIONS_PER_FRAME;
+          uint64_t step = std::min({fuzzCase.interval, frameLeft, fuzzCase.cycles - done});
+          for (auto& machine : machines)
+               machine->Run(step);
+          done += step;
+
+          if (done % INSTRUCTIONS_PER_FRAME == 0) {
+               //A new keypad every few frames, mostly one or two keys
+               bool change = (XorShift(keyState) & 3) == 0;
+               uint16_t keys = static_cast<uint16_t>(XorShift(keyState) & XorShift(keyState));
+               for (auto& machine : machines) {
+                    machine->TickTimers();
+                    if (change) {
+                         for (int key = 0; key < 16; ++key)
+                              machine->keypad[key] = (keys >> key) & 1;
+                    }
+               }
+          }
+          return true;
+     }
+
+     //Engine index of the first machine whose state differs from the reference, -1 if all agree
+     int Compare(size_t& offset) const
+     {
+          uint8_t expected[Chip8::STATE_SIZE];
+          uint8_t actual[Chip8::STATE_SIZE];
+          machines[0]->SaveState(expected, sizeof(expected));
+          for (size_t i = 1; i < machines.size(); ++i) {
+               machines[i]->SaveState(actual, sizeof(actual));
+               if (std::memcmp(expected, actual, sizeof(expected)) != 0) {
+                    offset = std::mismatch(expected, expected + sizeof(expected), actual).first - expected;
+                    return static_cast<int>(i - 1);
+               }
+          }
+          return -1;
+     }
+
+     uint64_t Done() const
+          {return done;}
+     Chip8& Reference(size_t) //One reference for every engine
+          {return *machines[0];}
+     void SaveTested(size_t engine, uint8_t* state) const
+          {machines[engine + 1]->SaveState(state, Chip8::STATE_SIZE);}
+
+private:
+     const FuzzCase& fuzzCase;
+     std::vector<std::unique_ptr<Chip8>> machines; //Chip8 is large, and copies would drop the JIT cache
+     uint64_t done = 0;
+     uint32_t keyState;
+};
+
+//Chip8Batch lanes on one case, each beside its own reference interpreter. Lanes get consecutive CXNN
+//seeds as Chip8Batch::SeedRandom() hands them out, and from lane 1 on random registers and their own
+//keypad changes, so they split onto different paths and back, which is what the grouping has to get right
+class BatchLockstep {
+
+public:
+     explicit BatchLockstep(const FuzzCase& fuzzCase)
+          : fuzzCase(fuzzCase), batch(BATCH_LANES)
+     {
+          uint64_t hash = HashImage(fuzzCase.image);
+          uint32_t seed = static_cast<uint32_t>(hash);
+          Chip8 image;
+          Boot(image, fuzzCase, Engine::Table, seed);
+          batch.SetQuirks(fuzzCase.quirks);
+          batch.LoadMachine(image);
+          batch.SeedRandom(seed);
+
+          for (size_t lane = 0; lane < BATCH_LANES; ++lane) {
+               keyStates[lane] = (static_cast<uint32_t>(hash >> 32) ^ static_cast<uint32_t>(lane * 0x9E3779B9)) | 1;
+               references.push_back(std::make_unique<Chip8>());
+               Boot(*references[lane], fuzzCase, Engine::Switch, seed + static_cast<uint32_t>(lane));
+
+               uint8_t registers[16]{};
+               if (lane > 0) {
+                    for (uint8_t reg = 0; reg < 16; ++reg) {
+                         registers[reg] = static_cast<uint8_t>(XorShift(keyStates[lane]));
+                         batch.SetRegister(lane, reg, registers[reg]);
+                    }
+               }
+               SetRegisters(*references[lane], registers);
+          }
+     }
+
+     bool Advance()
+     {
+          uint64_t cycles = std::min(fuzzCase.cycles, BATCH_CYCLES);
+          if (done >= cycles)
+               return false;
+          uint64_t frameLeft = INSTRUCTIONS_PER_FRAME - done % INSTRUCTIONS_PER_FRAME;
+          uint64_t step = std::min({fuzzCase.interval, frameLeft, cycles - done});
+          batch.Run(step);
+          for (auto& reference : references)
+               reference->Run(step);
+          done += step;
+
+          if (done % INSTRUCTIONS_PER_FRAME == 0) {
+               batch.TickTimers();
+               for (size_t lane = 0; lane < BATCH_LANES; ++lane) {
+                    references[lane]->TickTimers();
+                    if ((XorShift(keyStates[lane]) & 3) != 0)
+                         continue;
+                    uint16_t keys = static_cast<uint16_t>(XorShift(keyStates[lane]) & XorShift(keyStates[lane]));
+                    for (uint8_t key = 0; key < 16; ++key) {
+                         references[lane]->keypad[key] = (keys >> key) & 1;
+                         batch.SetKey(lane, key, (keys >> key) & 1);
+                    }
+               }
+          }
+          return true;
+     }
+
+     //First lane whose state differs from its reference, -1 if all agree
+     int Compare(size_t& offset)
+     {
+          uint8_t expected[Chip8::STATE_SIZE];
+          uint8_t actual[Chip8::STATE_SIZE];
+          for (size_t lane = 0; lane < BATCH_LANES; ++lane) {
+               references[lane]->SaveState(expected, sizeof(expected));
+               SaveTested(lane, actual);
+               if (std::memcmp(expected, actual, sizeof(expected)) != 0) {
+                    offset = std::mismatch(expected, expected + sizeof(expected), actual).first - expected;
+                    return static_cast<int>(lane);
+               }
+          }
+          return -1;
+     }
+
+     uint64_t Done() const
+          {return done;}
+     Chip8& Reference(size_t lane)
+          {return *references[lane];}
+     void SaveTested(size_t lane, uint8_t* state)
+          {batch.Lane(lane).SaveState(state, Chip8::STATE_SIZE);}
+
+private:
+     const FuzzCase& fuzzCase;
+     Chip8Batch batch;
+     std::vector<std::unique_ptr<Chip8>> references;
+     uint32_t keyStates[BATCH_LANES];
+     uint64_t done = 0;
+};
+
+//Runs the case against every engine, then against the batch lanes if batch is set
+static bool FindDivergence(const FuzzCase& fuzzCase, const std::vector<Engine>& engines, bool batch, Divergence& divergence)
+{
+     if (!engines.empty()) {
+          Lockstep lockstep(fuzzCase, engines);
+          uint64_t lastMatch = 0;
+          while (lockstep.Advance()) {
+               size_t offset = 0;
+               int engine = lockstep.Compare(offset);
+               if (engine >= 0) {
+                    divergence = {engines[engine], -1, lockstep.Done(), lastMatch, offset};
+                    return true;
+               }
+               lastMatch = lockstep.Done();
+          }
+     }
+
+     if (batch) {
+          BatchLockstep lockstep(fuzzCase);
+          uint64_t lastMatch = 0;
+          while (lockstep.Advance()) {
+               size_t offset = 0;
+               int lane = lockstep.Compare(offset);
+               if (lane >= 0) {
+                    divergence = {Engine::Table, lane, lockstep.Done(), lastMatch, offset};
+                    return true;
+               }
+               lastMatch = lockstep.Done();
+          }
+     }
+     return false;
+}
+
+//Calls visit with a fresh lockstep holding the target that diverged, and that target's index in it
+template<typename Visit>
+static void WithLockstep(const FuzzCase& fuzzCase, const Divergence& divergence, Visit visit)
+{
+     if (divergence.lane >= 0) {
+          BatchLockstep lockstep(fuzzCase);
+          visit(lockstep, static_cast<size_t>(divergence.lane));
+     }
+     else {
+          Lockstep lockstep(fuzzCase, {divergence.engine});
+          visit(lockstep, 0);
+     }
+}
+
+//Shrinks a diverging case while it keeps diverging on the same engine: fewer cycles, smaller slices,
+//then zeroed and trimmed image bytes. 0000 decodes as a no-op, so zeroing straightens the program out.
+static FuzzCase Minimize(FuzzCase fuzzCase, Divergence& divergence)
+{
+     //Any lane will do for the batch, the lane that differs can move as the case shrinks
+     bool batch = divergence.lane >= 0;
+     std::vector<Engine> engine;
+     if (!batch)
+          engine.push_back(divergence.engine);
+     auto stillDiverges = [&](const FuzzCase& candidate) {
+          Divergence found;
+          if (!FindDivergence(candidate, engine, batch, found))
+               return false;
+          divergence = found;
+          return true;
+     };
+
+     bool progress = true;
+     while (progress) {
+          progress = false;
+          fuzzCase.cycles = divergence.cycle;
+
+          while (fuzzCase.interval > 1) {
+               FuzzCase candidate = fuzzCase;
+               candidate.interval /= 2;
+               if (!stillDiverges(candidate))
+                    break;
+               fuzzCase = candidate;
+               fuzzCase.cycles = divergence.cycle;
+               progress = true;
+          }
+
+          for (size_t chunk = std::max<size_t>(fuzzCase.image.size() / 2, 1); chunk >= 1; chunk /= 2) {
+               //Cut from the end first, the image shrinks instead of just going quiet
+               while (fuzzCase.image.size() > chunk) {
+                    FuzzCase candidate = fuzzCase;
+                    candidate.image.resize(fuzzCase.image.size() - chunk);
+                    if (!stillDiverges(candidate))
+                         break;
+                    fuzzCase = candidate;
+                    progress = true;
+               }
+               for (size_t start = 0; start < fuzzCase.image.size(); start += chunk) {
+                    size_t end = std::min(start + chunk, fuzzCase.image.size());
+                    if (std::all_of(fuzzCase.image.begin() + start, fuzzCase.image.begin() + end, [](uint8_t b) { return b == 0; }))
+                         continue;
+                    FuzzCase candidate = fuzzCase;
+                    std::fill(candidate.image.begin() + start, candidate.image.begin() + end, 0);
+                    if (stillDiverges(candidate)) {
+                         fuzzCase = candidate;
+                         progress = true;
+                    }
+               }
+               if (chunk == 1)
+                    break;
+          }
+     }
+     fuzzCase.cycles = divergence.cycle;
+     return fuzzCase;
+}
+
+static void PrintField(const char* label, const uint8_t* state, size_t fieldStart, const StateField& field, size_t index)
+{
+     const uint8_t* bytes = state + fieldStart + index * field.element;
+     uint64_t value = 0;
+     std::memcpy(&value, bytes, field.element); //Host byte order, as SaveState() writes it
+     char text[64];
+     std::snprintf(text, sizeof(text), "0x%0*llX", static_cast<int>(field.element * 2), static_cast<unsigned long long>(value));
+     std::cout << "  " << label << ": " << text << "\n";
+}
+
+static void Report(const FuzzCase& fuzzCase, const Divergence& divergence)
+{
+     WithLockstep(fuzzCase, divergence, [&](auto& lockstep, size_t tested) {
+          while (lockstep.Done() < divergence.lastMatch)
+               lockstep.Advance();
+
+          //The reference alone, one instruction at a time, over the slice where they parted
+          Chip8& reference = lockstep.Reference(tested);
+          uint8_t state[Chip8::STATE_SIZE];
+          std::cout << "reference instructions after the last matching check at cycle " << divergence.lastMatch << ":\n";
+          for (uint64_t cycle = divergence.lastMatch; cycle < divergence.cycle; ++cycle) {
+               reference.SaveState(state, sizeof(state));
+               uint16_t pc;
+               std::memcpy(&pc, state + STATE_PC, sizeof(pc));
+               uint16_t opcode = reference.GetMemory()[pc & 0xFFF] << 8 | reference.GetMemory()[(pc + 1) & 0xFFF];
+               char line[64];
+               std::snprintf(line, sizeof(line), "  %8llu  %03X  %04X  %s", static_cast<unsigned long long>(cycle),
+                             static_cast<unsigned>(pc), static_cast<unsigned>(opcode), Disassemble(opcode).c_str());
+               std::cout << line << "\n";
+               reference.Run(1);
+          }
+     });
+
+     //The whole slice again on both, then show the first field that differs
+     uint8_t expected[Chip8::STATE_SIZE];
+     uint8_t actual[Chip8::STATE_SIZE];
+     WithLockstep(fuzzCase, divergence, [&](auto& after, size_t tested) {
+          while (after.Done() < divergence.cycle)
+               after.Advance();
+          after.Reference(tested).SaveState(expected, sizeof(expected));
+          after.SaveTested(tested, actual);
+     });
+
+     size_t fieldStart = 0;
+     for (const StateField& field : STATE_FIELDS) {
+          if (divergence.offset < fieldStart + field.size) {
+               size_t index = (divergence.offset - fieldStart) / field.element;
+               std::cout << "first difference in " << field.name;
+               if (field.element < field.size)
+                    std::cout << "[" << index << "]";
+               std::cout << " after cycle " << divergence.cycle << "\n";
+               PrintField("reference", expected, fieldStart, field, index);
+               PrintField(TargetName(divergence).c_str(), actual, fieldStart, field, index);
+               break;
+          }
+          fieldStart += field.size;
+     }
+}
+
+static bool WriteImage(const std::filesystem::path& filepath, const std::vector<uint8_t>& image)
+{
+     std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+     if (!file.is_open())
+          return false;
+     file.write(reinterpret_cast<const char*>(image.data()), image.size());
+     return file.good();
+}
+
+static bool ReadImage(const std::filesystem::path& filepath, std::vector<uint8_t>& image)
+{
+     std::ifstream file(filepath, std::ios::binary);
+     if (!file.is_open())
+          return false;
+     image.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+     if (image.size() > IMAGE_SIZE)
+          image.resize(IMAGE_SIZE);
+     return true;
+}
+
+//Minimizes, prints and saves a divergence; the repro file is the image, loadable as a ROM up to 3584 bytes
+static void HandleDivergence(FuzzCase fuzzCase, Divergence divergence, const std::filesystem::path& reproPath)
+{
+     std::cout << "DIVERGENCE: " << TargetName(divergence) << " differs from the reference interpreter (quirks "
+               << QuirkProfileName(fuzzCase.quirks) << ", " << fuzzCase.image.size() << " byte image, cycle " << divergence.cycle << ")\n";
+     fuzzCase = Minimize(fuzzCase, divergence);
+     std::cout << "minimized to " << fuzzCase.image.size() << " bytes, " << fuzzCase.cycles << " cycles, checked every "
+               << fuzzCase.interval << "\n";
+     Report(fuzzCase, divergence);
+
+     if (WriteImage(reproPath, fuzzCase.image))
+          std::cout << "repro written to " << reproPath.string() << ", rerun with:\n  chip8_fuzz --repro " << reproPath.string()
+                    << " --engine " << (divergence.lane >= 0 ? "batch" : EngineName(divergence.engine)) << " --quirks " << QuirkProfileName(fuzzCase.quirks)
+                    << " --cycles " << fuzzCase.cycles << " --interval " << fuzzCase.interval << std::endl;
+     else
+          std::cerr << "Could not write repro: " << reproPath << std::endl;
+}
+
+#ifdef CHIP8_LIBFUZZER
+
+//First byte picks the quirk profile, the rest is the image; every engine is checked on every input
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+     if (size < 2)
+          return 0;
+
+     FuzzCase fuzzCase;
+     fuzzCase.quirks = PROFILES[data[0] & 3];
+     fuzzCase.image.assign(data + 1, data + std::min(size, IMAGE_SIZE + 1));
+     fuzzCase.cycles = LIBFUZZER_CYCLES;
+
+     Divergence divergence;
+     if (FindDivergence(fuzzCase, std::vector<Engine>(std::begin(TESTED_ENGINES), std::end(TESTED_ENGINES)), true, divergence)) {
+          HandleDivergence(fuzzCase, divergence, "fuzz-repro.ch8");
+          std::abort(); //libFuzzer saves the unminimized input as a crash
+     }
+     return 0;
+}
+
+#else
+
+struct Options {
+     uint64_t runs = DEFAULT_RUNS;
+     uint64_t cycles = DEFAULT_CYCLES;
+     uint64_t interval = DEFAULT_INTERVAL;
+     uint64_t seed = 1;
+     std::vector<Engine> engines{std::begin(TESTED_ENGINES), std::end(TESTED_ENGINES)};
+     bool batch = true; //Chip8Batch lanes as well
+     std::vector<QuirkProfile> profiles{std::begin(PROFILES), std::end(PROFILES)};
+     std::vector<std::vector<uint8_t>> corpus; //Images to mutate, random programs only when empty
+     std::filesystem::path reproPath = "fuzz-repro.ch8";
+     std::filesystem::path replayPath; //--repro: check one image instead of fuzzing
+};
+
+static void PrintUsage(const char* program)
+{
+     std::cerr << "Usage: " << program << " [options] [ROM files or directories to mutate]\n"
+               << "  --runs N      Programs to try (default " << DEFAULT_RUNS << ")\n"
+               << "  --cycles N    Instructions per program (default " << DEFAULT_CYCLES << ")\n"
+               << "  --interval N  Instructions between state checks (default " << DEFAULT_INTERVAL << ")\n"
+               << "  --seed N      Generator seed (default 1)\n"
+               << "  --engine E    Engine under test: table, cached, jit or batch, the lockstep lanes of\n"
+               << "                --lanes (default all four)\n"
+               << "  --quirks Q    Quirk profile: chip8, vip, chip48 or schip (default a different one per program)\n"
+               << "  --out FILE    Where to write the minimized repro (default fuzz-repro.ch8)\n"
+               << "  --repro FILE  Run one image in lockstep instead of fuzzing, exit 1 if it diverges\n";
+}
+
+static bool ParseCount(const char* text, uint64_t& out)
+{
+     char* end = nullptr;
+     out = std::strtoull(text, &end, 10);
+     return *text != '\0' && *end == '\0';
+}
+
+static bool AddCorpus(const std::filesystem::path& source, Options& options)
+{
+     std::vector<std::filesystem::path> files;
+     if (std::filesystem::is_directory(source)) {
+          for (const auto& entry : std::filesystem::recursive_directory_iterator(source)) {
+               std::string extension = entry.path().extension().string();
+               if (entry.is_regular_file() && (extension == ".ch8" || extension == ".rom"))
+                    files.push_back(entry.path());
+          }
+          //Directory order is unspecified, keep runs with the same seed identical
+          std::sort(files.begin(), files.end());
+     }
+     else
+          files.push_back(source);
+
+     for (const auto& file : files) {
+          std::vector<uint8_t> image;
+          if (!ReadImage(file, image)) {
+               std::cerr << "Could not read: " << file << std::endl;
+               return false;
+          }
+          if (!image.empty())
+               options.corpus.push_back(std::move(image));
+     }
+     return true;
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options)
+{
+     for (int i = 1; i < argc; ++i) {
+          std::string arg = argv[i];
+          bool hasValue = i + 1 < argc;
+
+          if (arg == "--runs" && hasValue && ParseCount(argv[i + 1], options.runs)) {
+               ++i;
+          }
+          else if (arg == "--cycles" && hasValue && ParseCount(argv[i + 1], options.cycles) && options.cycles > 0) {
+               ++i;
+          }
+          else if (arg == "--interval" && hasValue && ParseCount(argv[i + 1], options.interval) && options.interval > 0) {
+               ++i;
+          }
+          else if (arg == "--seed" && hasValue && ParseCount(argv[i + 1], options.seed)) {
+               ++i;
+          }
+          else if (arg == "--engine" && hasValue) {
+               std::string name = argv[++i];
+               options.batch = false;
+               if (name == "table")
+                    options.engines = {Engine::Table};
+               else if (name == "cached")
+                    options.engines = {Engine::Cached};
+               else if (name == "jit")
+                    options.engines = {Engine::Jit};
+               else if (name == "batch") {
+                    options.engines.clear();
+                    options.batch = true;
+               }
+               else {
+                    std::cerr << "Unknown engine: " << name << std::endl;
+                    return false;
+               }
+          }
+          else if (arg == "--quirks" && hasValue) {
+               QuirkProfile profile;
+               if (!ParseQuirkProfile(argv[++i], profile)) {
+                    std::cerr << "Unknown quirk profile: " << argv[i] << std::endl;
+                    return false;
+               }
+               options.profiles = {profile};
+          }
+          else if (arg == "--out" && hasValue) {
+               options.reproPath = argv[++i];
+          }
+          else if (arg == "--repro" && hasValue) {
+               options.replayPath = argv[++i];
+          }
+          else if (!arg.empty() && arg[0] != '-') {
+               if (!AddCorpus(arg, options))
+                    return false;
+          }
+          else {
+               PrintUsage(argv[0]);
+               return false;
+          }
+     }
+     return true;
+}
+
+//A random opcode, biased toward valid instructions and toward targets inside the program
+static uint16_t RandomOpcode(std::mt19937_64& rng, size_t programSize)
+{
+     static const uint8_t F_OPS[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+     static const uint8_t ALU_OPS[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+
+     uint16_t opcode = static_cast<uint16_t>(rng());
+     if (rng() % 16 == 0)
+          return opcode; //Anything, unknown opcodes included
+
+     uint16_t x = opcode & 0x0F00;
+     uint16_t family = opcode & 0xF000;
+     uint16_t target = static_cast<uint16_t>(ROM_START + 2 * (rng() % std::max<size_t>(programSize / 2, 1)));
+     switch (family)
+     {
+          case 0x0000:
+               return rng() % 2 ? 0x00E0 : 0x00EE;
+          case 0x1000:
+          case 0x2000:
+               return family | (target & 0x0FFF);
+          case 0x8000:
+               return (opcode & 0xFFF0) | ALU_OPS[rng() % sizeof(ALU_OPS)];
+          case 0xA000:
+               //Near the top of memory now and then, so sprites and stores run off the end
+               return rng() % 4 ? (family | (target & 0x0FFF)) : (family | (0xFF0 + rng() % 16));
+          case 0xB000:
+               return family | ((target - (rng() % 16)) & 0x0FFF);
+          case 0xE000:
+               return family | x | (rng() % 2 ? 0x9E : 0xA1);
+          case 0xF000:
+               return family | x | F_OPS[rng() % sizeof(F_OPS)];
+          default:
+               return opcode;
+     }
+}
+
+//An instruction that always falls through to the next one and never waits
+static uint16_t RandomStraightOpcode(std::mt19937_64& rng, size_t programSize)
+{
+     static const uint8_t F_OPS[] = {0x07, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+     for (;;) {
+          uint16_t opcode = RandomOpcode(rng, programSize);
+          switch (opcode & 0xF000)
+          {
+               case 0x6000: case 0x7000: case 0x8000: case 0xA000: case 0xC000: case 0xD000:
+                    return opcode;
+               case 0xF000:
+                    return (opcode & 0xFF00) | F_OPS[rng() % sizeof(F_OPS)];
+               default:
+                    break;
+          }
+     }
+}
+
+//Blocks of a skip and two branches that take the same number of cycles, in a loop. Lanes of a batch
+//split on the skip and meet again at the next block on the same cycle, often after only one side
+//stored into the code both are about to run
+static std::vector<uint8_t> BalancedProgram(std::mt19937_64& rng)
+{
+     static const uint16_t SKIPS[] = {0x3000, 0x4000, 0x5000, 0x9000, 0xE09E, 0xE0A1};
+     std::vector<uint16_t> program;
+     size_t blocks = 1 + rng() % 8;
+     size_t programSize = blocks * 24; //Rough, only steers ANNN toward the program
+
+     for (size_t block = 0; block < blocks; ++block) {
+          size_t length = 1 + rng() % 6;
+          uint16_t skip = static_cast<uint16_t>(SKIPS[rng() % (sizeof(SKIPS) / sizeof(SKIPS[0]))] | (rng() % 16) << 8);
+          if ((skip & 0xF000) == 0x3000 || (skip & 0xF000) == 0x4000)
+               skip |= static_cast<uint16_t>(rng() % 2 ? rng() % 4 : rng() % 256);
+          else if ((skip & 0xF000) != 0xE000)
+               skip |= static_cast<uint16_t>((rng() % 16) << 4);
+
+          //skip, JP other, taken side: length ops, JP end; other side: length - 1 ops, JP end
+          uint16_t start = static_cast<uint16_t>(ROM_START + 2 * program.size());
+          uint16_t other = static_cast<uint16_t>(start + 2 * (3 + length));
+          uint16_t end = static_cast<uint16_t>(other + 2 * length);
+          program.push_back(skip);
+          program.push_back(0x1000 | other);
+          for (size_t i = 0; i < length; ++i)
+               program.push_back(RandomStraightOpcode(rng, programSize));
+          program.push_back(0x1000 | end);
+          for (size_t i = 0; i + 1 < length; ++i)
+               program.push_back(RandomStraightOpcode(rng, programSize));
+          program.push_back(0x1000 | end);
+     }
+     program.push_back(0x1000 | ROM_START);
+
+     std::vector<uint8_t> image;
+     for (uint16_t opcode : program) {
+          image.push_back(static_cast<uint8_t>(opcode >> 8));
+          image.push_back(static_cast<uint8_t>(opcode));
+     }
+     return image;
+}
+
+static std::vector<uint8_t> RandomProgram(std::mt19937_64& rng)
+{
+     if (rng() % 4 == 0)
+          return BalancedProgram(rng);
+
+     std::vector<uint8_t> image;
+     if (rng() % 8 == 0) {
+          //Plain random bytes, sometimes the whole 4 KB so the program runs into the interpreter area
+          image.resize(1 + rng() % IMAGE_SIZE);
+          for (uint8_t& byte : image)
+               byte = static_cast<uint8_t>(rng());
+          return image;
+     }
+
+     size_t instructions = 1 + rng() % 256;
+     for (size_t i = 0; i < instructions; ++i) {
+          uint16_t opcode = RandomOpcode(rng, instructions * 2);
+          image.push_back(static_cast<uint8_t>(opcode >> 8));
+          image.push_back(static_cast<uint8_t>(opcode));
+     }
+     return image;
+}
+
+static std::vector<uint8_t> Mutate(std::vector<uint8_t> image, std::mt19937_64& rng)
+{
+     int mutations = 1 + static_cast<int>(rng() % 8);
+     for (int i = 0; i < mutations; ++i) {
+          size_t at = image.empty() ? 0 : rng() % image.size();
+          switch (rng() % 5)
+          {
+               case 0: //Flip a bit
+                    if (!image.empty())
+                         image[at] ^= static_cast<uint8_t>(1 << (rng() % 8));
+                    break;
+               case 1: //Replace an instruction
+               {
+                    at &= ~static_cast<size_t>(1);
+                    uint16_t opcode = RandomOpcode(rng, image.size());
+                    if (at + 1 < image.size()) {
+                         image[at] = static_cast<uint8_t>(opcode >> 8);
+                         image[at + 1] = static_cast<uint8_t>(opcode);
+                    }
+                    break;
+               }
+               case 2: //Insert an instruction
+               {
+                    if (image.size() + 2 > IMAGE_SIZE)
+                         break;
+                    at &= ~static_cast<size_t>(1);
+                    uint16_t opcode = RandomOpcode(rng, image.size());
+                    image.insert(image.begin() + std::min(at, image.size()), {static_cast<uint8_t>(opcode >> 8), static_cast<uint8_t>(opcode)});
+                    break;
+               }
+               case 3: //Copy a block over another place
+               {
+                    if (image.size() < 4)
+                         break;
+                    size_t length = 1 + rng() % std::min<size_t>(64, image.size() / 2);
+                    size_t from = rng() % (image.size() - length);
+                    size_t to = rng() % (image.size() - length);
+                    std::copy(image.begin() + from, image.begin() + from + length, image.begin() + to);
+                    break;
+               }
+               default: //Drop the tail
+                    if (image.size() > 2)
+                         image.resize(2 + rng() % (image.size() - 1));
+                    break;
+          }
+     }
+     return image;
+}
+
+static int RunRepro(const Options& options)
+{
+     FuzzCase fuzzCase;
+     if (!ReadImage(options.replayPath, fuzzCase.image)) {
+          std::cerr << "Could not read: " << options.replayPath << std::endl;
+          return 1;
+     }
+     fuzzCase.quirks = options.profiles[0];
+     fuzzCase.cycles = options.cycles;
+     fuzzCase.interval = options.interval;
+
+     Divergence divergence;
+     if (!FindDivergence(fuzzCase, options.engines, options.batch, divergence)) {
+          std::cout << "no divergence in " << fuzzCase.cycles << " cycles" << std::endl;
+          return 0;
+     }
+     HandleDivergence(fuzzCase, divergence, options.reproPath);
+     return 1;
+}
+
+int main(int argc, char* argv[]) {
+
+     Options options;
+     if (!ParseOptions(argc, argv, options))
+          return 1;
+     if (!options.replayPath.empty())
+          return RunRepro(options);
+
+     std::mt19937_64 rng(options.seed);
+     auto start = std::chrono::steady_clock::now();
+     uint64_t instructions = 0;
+
+     for (uint64_t run = 0; run < options.runs; ++run) {
+          FuzzCase fuzzCase;
+          if (!options.corpus.empty() && rng() % 4 != 0)
+               fuzzCase.image = Mutate(options.corpus[rng() % options.corpus.size()], rng);
+          else
+               fuzzCase.image = RandomProgram(rng);
+          fuzzCase.quirks = options.profiles[run % options.profiles.size()];
+          fuzzCase.cycles = options.cycles;
+          fuzzCase.interval = options.interval;
+
+          Divergence divergence;
+          if (FindDivergence(fuzzCase, options.engines, options.batch, divergence)) {
+               std::cout << "run " << run << " of seed " << options.seed << "\n";
+               HandleDivergence(fuzzCase, divergence, options.reproPath);
+               return 1;
+          }
+          instructions += fuzzCase.cycles * (options.engines.size() + 1) + (options.batch ? std::min(fuzzCase.cycles, BATCH_CYCLES) * 2 * BATCH_LANES : 0);
+     }
+
+     double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+     std::cout << options.runs << " programs, no divergence, " << options.engines.size() << " engines"
+               << (options.batch ? " and " + std::to_string(BATCH_LANES) + " batch lanes, " : ", ")
+               << seconds << " s, " << static_cast<uint64_t>(instructions / std::max(seconds, 1e-9)) << " instructions/sec" << std::endl;
+     return 0;
+}
+
+#endif
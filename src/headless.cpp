@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <batch.hpp>
+#include <chip8.hpp>
+#include <frame_capture.hpp>
+#include <frame_server.hpp>
+#include <keyscript.hpp>
+#include <movie.hpp>
+#include <rom_cache.hpp>
+#include <runner.hpp>
+#include <trace_ring.hpp>
+
+const int DEFAULT_INSTRUCTIONS_PER_FRAME = 15;
+const uint64_t DEFAULT_FRAMES = 600; //10 seconds of guest time at 60 Hz
+
+struct Options {
+     std::filesystem::path romPath;
+     uint64_t cycleBudget = 0;
+     uint64_t frameBudget = DEFAULT_FRAMES;
+     uint64_t instructionsPerFrame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+     KeyScript keys;
+     Engine engine = Engine::Table;
+     QuirkProfile quirks = QuirkProfile::Chip8;
+     bool quirksGiven = false; //Otherwise looked up in quirks.txt beside the ROM
+     uint64_t seed = 1;
+     uint64_t lanes = 0; //0 runs a single Chip8, otherwise the lockstep batch engine
+     bool verify = false;
+     std::filesystem::path profilePath; //Empty unless --profile was given
+     std::filesystem::path capturePath; //Empty unless --capture was given
+     uint64_t captureScale = 1;
+     std::filesystem::path recordPath; //Empty unless --record was given
+     std::filesystem::path replayPath; //Empty unless --replay was given
+     std::filesystem::path tracePath; //Empty unless --trace was given
+     uint64_t traceSize = 1 << 16;
+     std::filesystem::path servePath; //Empty unless --serve was given
+};
+
+static void PrintUsage(const char* program)
+{
+     std::cerr << "Usage: " << program << " <ROM file> [options]\n"
+               << "  --cycles N   Run for N instructions\n"
+               << "  --frames N   Run for N frames (default " << DEFAULT_FRAMES << ")\n"
+               << "  --ipf N      Instructions per frame (default " << DEFAULT_INSTRUCTIONS_PER_FRAME << ")\n"
+               << "  --keys FILE  Keypad script, lines of: <frame> <key 0-F> <down|up>\n"
+               << "  --engine E   Execution engine: switch, table, cached or jit (default table)\n"
+               << "  --quirks Q   Quirk profile: chip8, vip, chip48 or schip (default from quirks.txt\n"
+               << "               beside the ROM, else chip8)\n"
+               << "  --seed N     CXNN random seed (default 1)\n"
+               << "  --lanes N    Run N copies in lockstep on the batch engine, lane i seeded with seed + i\n"
+               << "  --verify     With --lanes, check every lane against the reference interpreter\n"
+               << "  --profile F  Write the guest profile to F, folded stacks for .folded, JSON otherwise\n"
+               << "               (needs a CHIP8_PROFILE build)\n"
+               << "  --capture F  Record every frame to F: .y4m video, .png numbered images or raw RGBA\n"
+               << "               Frames the writer can't keep up with are dropped and counted\n"
+               << "  --capture-scale N  Pixel size of the capture (default 1)\n"
+               << "  --record F   Save the run as an input movie: keypad changes, seed and frame hashes\n"
+               << "  --replay F   Replay a movie at full speed and report the first frame that differs\n"
+               << "  --trace F    Keep the last instructions in a ring and write it to F at exit, on SIGUSR1\n"
+               << "               or on a crash; read it with chip8_trace\n"
+               << "  --trace-size N  Instructions the trace ring holds (default 65536)\n"
+               << "  --serve SOCK Wait for a controller on the Unix domain socket SOCK and run frames and\n"
+               << "               key events it sends, streaming display deltas back, until it quits\n";
+}
+
+static bool ParseCount(const char* text, uint64_t& out)
+{
+     char* end = nullptr;
+     out = std::strtoull(text, &end, 10);
+     return *text != '\0' && *end == '\0';
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options)
+{
+     options.romPath = argv[1];
+
+     for (int i = 2; i < argc; ++i) {
+          std::string arg = argv[i];
+          bool hasValue = i + 1 < argc;
+
+          if (arg == "--cycles" && hasValue && ParseCount(argv[i + 1], options.cycleBudget)) {
+               options.frameBudget = 0;
+               ++i;
+          }
+          else if (arg == "--frames" && hasValue && ParseCount(argv[i + 1], options.frameBudget)) {
+               options.cycleBudget = 0;
+               ++i;
+          }
+          else if (arg == "--ipf" && hasValue && ParseCount(argv[i + 1], options.instructionsPerFrame) && options.instructionsPerFrame > 0) {
+               ++i;
+          }
+          else if (arg == "--keys" && hasValue) {
+               if (!options.keys.Load(argv[i + 1])) {
+                    std::cerr << "Could not read key script: " << argv[i + 1] << std::endl;
+                    return false;
+               }
+               ++i;
+          }
+          else if (arg == "--engine" && hasValue) {
+               std::string name = argv[++i];
+               if (name == "switch")
+                    options.engine = Engine::Switch;
+               else if (name == "table")
+                    options.engine = Engine::Table;
+               else if (name == "cached")
+                    options.engine = Engine::Cached;
+               else if (name == "jit")
+                    options.engine = Engine::Jit;
+               else {
+                    std::cerr << "Unknown engine: " << name << std::endl;
+                    return false;
+               }
+          }
+          else if (arg == "--quirks" && hasValue) {
+               if (!ParseQuirkProfile(argv[++i], options.quirks)) {
+                    std::cerr << "Unknown quirk profile: " << argv[i] << std::endl;
+                    return false;
+               }
+               options.quirksGiven = true;
+          }
+          else if (arg == "--seed" && hasValue && ParseCount(argv[i + 1], options.seed)) {
+               ++i;
+          }
+          else if (arg == "--lanes" && hasValue && ParseCount(argv[i + 1], options.lanes) && options.lanes > 0) {
+               ++i;
+          }
+          else if (arg == "--verify") {
+               options.verify = true;
+          }
+          else if (arg == "--profile" && hasValue) {
+#ifdef CHIP8_PROFILE
+               options.profilePath = argv[++i];
+#else
+               std::cerr << "--profile needs a build configured with -DCHIP8_PROFILE=ON" << std::endl;
+               return false;
+#endif
+          }
+          else if (arg == "--capture" && hasValue) {
+               options.capturePath = argv[++i];
+          }
+          else if (arg == "--capture-scale" && hasValue && ParseCount(argv[i + 1], options.captureScale) && options.captureScale > 0) {
+               ++i;
+          }
+          else if (arg == "--record" && hasValue) {
+               options.recordPath = argv[++i];
+          }
+          else if (arg == "--replay" && hasValue) {
+               options.replayPath = argv[++i];
+          }
+          else if (arg == "--trace" && hasValue) {
+               options.tracePath = argv[++i];
+          }
+          else if (arg == "--trace-size" && hasValue && ParseCount(argv[i + 1], options.traceSize) && options.traceSize > 0) {
+               ++i;
+          }
+          else if (arg == "--serve" && hasValue) {
+               options.servePath = argv[++i];
+          }
+          else {
+               PrintUsage(argv[0]);
+               return false;
+          }
+     }
+
+     if (!options.profilePath.empty() && options.lanes > 0) {
+          std::cerr << "--profile is not supported with --lanes" << std::endl;
+          return false;
+     }
+     if (!options.capturePath.empty() && options.lanes > 0) {
+          std::cerr << "--capture is not supported with --lanes" << std::endl;
+          return false;
+     }
+     if ((!options.recordPath.empty() || !options.replayPath.empty()) && options.lanes > 0) {
+          std::cerr << "--record and --replay are not supported with --lanes" << std::endl;
+          return false;
+     }
+     if (!options.tracePath.empty() && (options.lanes > 0 || !options.replayPath.empty())) {
+          std::cerr << "--trace is not supported with --lanes or --replay" << std::endl;
+          return false;
+     }
+     if (!options.servePath.empty() && (options.lanes > 0 || !options.replayPath.empty() || !options.recordPath.empty() ||
+                                        !options.capturePath.empty() || !options.tracePath.empty())) {
+          std::cerr << "--serve can't be combined with --lanes, --replay, --record, --capture or --trace" << std::endl;
+          return false;
+     }
+     if (!options.recordPath.empty() && !options.replayPath.empty()) {
+          std::cerr << "--record and --replay can't be combined" << std::endl;
+          return false;
+     }
+
+     if (options.frameBudget > 0)
+          options.cycleBudget = options.frameBudget * options.instructionsPerFrame;
+     return true;
+}
+
+static double SecondsSince(std::chrono::steady_clock::time_point start)
+{
+     double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+     return seconds > 0.0 ? seconds : 1e-9;
+}
+
+static QuirkProfile RomQuirks(const Options& options)
+{
+     if (options.quirksGiven)
+          return options.quirks;
+     std::shared_ptr<const RomImage> image = RomCache::Shared().Load(options.romPath);
+     return image ? LookupQuirks(options.romPath, image->Hash()) : QuirkProfile::Chip8;
+}
+
+static int RunSingle(Options& options)
+{
+     Chip8 chip8;
+     chip8.Initialize();
+     if (!chip8.LoadROM(options.romPath))
+          return 1;
+     chip8.SetEngine(options.engine);
+     chip8.SetQuirks(RomQuirks(options));
+     chip8.SeedRandom(static_cast<uint32_t>(options.seed));
+
+     //Sized up front, the ring never allocates while the ROM runs
+     std::unique_ptr<TraceRing> trace;
+     if (!options.tracePath.empty()) {
+          trace = std::make_unique<TraceRing>(std::min<uint64_t>(options.traceSize, 1 << 26));
+          if (!trace->InstallSignalHandlers(options.tracePath))
+               std::cerr << "Trace dumps on signals are not available here, writing at exit only" << std::endl;
+          chip8.SetTrace(trace.get());
+     }
+
+     FrameCapture capture(ON_COLOR, OFF_COLOR, static_cast<int>(std::min<uint64_t>(options.captureScale, 16)));
+     if (!options.capturePath.empty() && !capture.Open(options.capturePath))
+          return 1;
+
+     bool recording = !options.recordPath.empty();
+     InputMovie movie;
+     if (recording)
+          movie.Start(chip8, RomCache::Shared().Load(options.romPath)->Hash(), static_cast<uint32_t>(options.seed), static_cast<uint32_t>(options.instructionsPerFrame));
+
+     //Frame N-1 is complete when the keys for frame N are applied
+     auto beginFrame = [&](uint64_t frame) {
+          if (frame > 0) {
+               capture.Submit(chip8.gfx);
+               if (recording)
+                    movie.RecordFrame(chip8);
+          }
+          options.keys.Apply(frame, chip8.keypad);
+          if (recording)
+               movie.RecordKeys(chip8);
+     };
+
+     auto start = std::chrono::steady_clock::now();
+     uint64_t frames = RunFrames(chip8, options.cycleBudget, options.instructionsPerFrame, beginFrame);
+     double seconds = SecondsSince(start);
+     uint64_t cycles = options.cycleBudget;
+     if (frames > 0 && cycles % options.instructionsPerFrame == 0) {
+          capture.Submit(chip8.gfx);
+          if (recording)
+               movie.RecordFrame(chip8);
+     }
+
+     std::cout << "quirks: " << QuirkProfileName(chip8.GetQuirks()) << "\n"
+               << "cycles: " << cycles << "\n"
+               << "frames: " << frames << "\n"
+               << "seconds: " << seconds << "\n"
+               << "instructions/sec: " << static_cast<uint64_t>(cycles / seconds) << "\n"
+               << "ns/instruction: " << (cycles ? seconds * 1e9 / cycles : 0.0) << "\n"
+               << "frames/sec: " << static_cast<uint64_t>(frames / seconds) << "\n"
+               << "framebuffer hash: 0x" << std::hex << chip8.DisplayHash() << std::dec << std::endl;
+
+     if (!options.capturePath.empty()) {
+          if (!capture.Close())
+               return 1;
+          std::cout << "captured frames: " << capture.Written() << "\n"
+                    << "dropped frames: " << capture.Dropped() << std::endl;
+     }
+
+     if (recording) {
+          if (!movie.Save(options.recordPath)) {
+               std::cerr << "Could not write movie: " << options.recordPath << std::endl;
+               return 1;
+          }
+          std::cout << "recorded frames: " << movie.Frames() << "\n"
+                    << "recorded key changes: " << movie.KeyChanges() << std::endl;
+     }
+
+     if (trace) {
+          chip8.SetTrace(nullptr);
+          if (!trace->Dump(options.tracePath)) {
+               std::cerr << "Could not write trace: " << options.tracePath << std::endl;
+               return 1;
+          }
+          std::cout << "traced instructions: " << std::min<uint64_t>(trace->Total(), trace->Capacity()) << "/" << trace->Total() << std::endl;
+     }
+
+#ifdef CHIP8_PROFILE
+     if (!options.profilePath.empty() && !chip8.GetProfile().Write(options.profilePath)) {
+          std::cerr << "Could not write profile: " << options.profilePath << std::endl;
+          return 1;
+     }
+#endif
+     return 0;
+}
+
+static int RunReplay(Options& options)
+{
+     InputMovie movie;
+     if (!movie.Load(options.replayPath)) {
+          std::cerr << "Could not read movie: " << options.replayPath << std::endl;
+          return 1;
+     }
+     std::shared_ptr<const RomImage> image = RomCache::Shared().Load(options.romPath);
+     if (!image)
+          return 1;
+     if (image->Hash() != movie.RomHash()) {
+          std::cerr << "Movie was recorded with a different ROM" << std::endl;
+          return 1;
+     }
+
+     Chip8 chip8;
+     chip8.Initialize();
+     chip8.LoadImage(*image);
+     chip8.SetEngine(options.engine);
+
+     auto start = std::chrono::steady_clock::now();
+     uint64_t divergedFrame = 0;
+     bool matched = movie.Replay(chip8, divergedFrame);
+     double seconds = SecondsSince(start);
+     uint64_t frames = matched ? movie.Frames() : divergedFrame + 1;
+
+     std::cout << "quirks: " << QuirkProfileName(movie.Quirks()) << "\n"
+               << "frames: " << frames << "/" << movie.Frames() << "\n"
+               << "key changes: " << movie.KeyChanges() << "\n"
+               << "seconds: " << seconds << "\n"
+               << "frames/sec: " << static_cast<uint64_t>(frames / seconds) << std::endl;
+     if (!matched) {
+          std::cout << "first diverging frame: " << divergedFrame << std::endl;
+          return 1;
+     }
+     std::cout << "all frames match" << std::endl;
+     return 0;
+}
+
+//Frames and keys come from the controller, --frames, --cycles and --keys don't apply
+static int RunServer(Options& options)
+{
+     Chip8 chip8;
+     chip8.Initialize();
+     if (!chip8.LoadROM(options.romPath))
+          return 1;
+     chip8.SetEngine(options.engine);
+     chip8.SetQuirks(RomQuirks(options));
+     chip8.SeedRandom(static_cast<uint32_t>(options.seed));
+
+     FrameServer server(chip8, options.instructionsPerFrame);
+     if (!server.Listen(options.servePath))
+          return 1;
+     std::cout << "serving on " << options.servePath.string() << std::endl;
+
+     auto start = std::chrono::steady_clock::now();
+     bool served = server.Serve();
+     double seconds = SecondsSince(start);
+     server.Close();
+
+     std::cout << "frames: " << server.Frames() << "\n"
+               << "requests: " << server.Requests() << "\n"
+               << "bytes sent: " << server.BytesSent() << "\n"
+               << "bytes/frame: " << (server.Frames() ? static_cast<double>(server.BytesSent()) / server.Frames() : 0.0) << "\n"
+               << "seconds: " << seconds << "\n"
+               << "framebuffer hash: 0x" << std::hex << chip8.DisplayHash() << std::dec << std::endl;
+     return served ? 0 : 1;
+}
+
+static int RunBatch(Options& options)
+{
+     Chip8Batch batch(options.lanes);
+     batch.SeedRandom(static_cast<uint32_t>(options.seed));
+     batch.SetQuirks(RomQuirks(options));
+     if (!batch.LoadROM(options.romPath))
+          return 1;
+
+     //Every lane gets the same script, lanes differ through their CXNN seeds
+     uint8_t scripted[16]{};
+     auto applyKeys = [&](uint64_t frame) {
+          options.keys.Apply(frame, scripted);
+          for (size_t lane = 0; lane < batch.Lanes(); ++lane) {
+               for (uint8_t key = 0; key < 16; ++key)
+                    batch.SetKey(lane, key, scripted[key]);
+          }
+     };
+
+     auto start = std::chrono::steady_clock::now();
+     uint64_t frames = RunFrames(batch, options.cycleBudget, options.instructionsPerFrame, applyKeys);
+     double seconds = SecondsSince(start);
+
+     std::unordered_set<uint64_t> hashes;
+     for (size_t lane = 0; lane < batch.Lanes(); ++lane)
+          hashes.insert(batch.Lane(lane).DisplayHash());
+
+     uint64_t laneInstructions = batch.LaneInstructions();
+     std::cout << "lanes: " << batch.Lanes() << "\n"
+               << "cycles per lane: " << options.cycleBudget << "\n"
+               << "frames per lane: " << frames << "\n"
+               << "seconds: " << seconds << "\n"
+               << "lane-instructions/sec: " << static_cast<uint64_t>(laneInstructions / seconds) << "\n"
+               << "vectorized: " << (laneInstructions ? 100.0 * batch.VectorLaneInstructions() / laneInstructions : 0.0) << "%\n"
+               << "lane 0 framebuffer hash: 0x" << std::hex << batch.Lane(0).DisplayHash() << std::dec << "\n"
+               << "distinct framebuffers: " << hashes.size() << std::endl;
+
+     if (!options.verify)
+          return 0;
+
+     size_t mismatches = 0;
+     for (size_t lane = 0; lane < batch.Lanes(); ++lane) {
+          Chip8 reference;
+          reference.Initialize();
+          reference.LoadROM(options.romPath);
+          reference.SetEngine(Engine::Switch);
+          reference.SetQuirks(RomQuirks(options));
+          reference.SeedRandom(static_cast<uint32_t>(options.seed + lane));
+          options.keys.Rewind();
+          RunFrames(reference, options.cycleBudget, options.instructionsPerFrame, [&](uint64_t frame) { options.keys.Apply(frame, reference.keypad); });
+
+          if (reference.DisplayHash() != batch.Lane(lane).DisplayHash()) {
+               std::cout << "lane " << lane << " differs from the reference interpreter" << std::endl;
+               ++mismatches;
+          }
+     }
+     std::cout << "verified lanes: " << batch.Lanes() - mismatches << "/" << batch.Lanes() << std::endl;
+     return mismatches ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+
+     if (argc < 2 || std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+          PrintUsage(argv[0]);
+          return argc < 2 ? 1 : 0;
+     }
+
+     Options options;
+     if (!ParseOptions(argc, argv, options))
+          return 1;
+
+     if (!options.replayPath.empty())
+          return RunReplay(options);
+     if (!options.servePath.empty())
+          return RunServer(options);
+     return options.lanes > 0 ? RunBatch(options) : RunSingle(options);
+}
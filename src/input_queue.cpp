@@ -0,0 +1,69 @@
+#include <input_queue.hpp>
+#include <algorithm>
+#include <chrono>
+
+const int64_t FIRST_WINDOW = 16666667; //Host time assumed before the first Run(), one 60 Hz frame
+
+InputQueue::InputQueue(uint64_t minimumHoldCycles)
+    : minimumHold(minimumHoldCycles)
+{
+}
+
+int64_t InputQueue::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void InputQueue::Push(uint8_t key, bool down, int64_t time)
+{
+    queue.TryPush(Event{time, static_cast<uint8_t>(key & 0xF), down});
+}
+
+uint64_t InputQueue::Schedule(const Event& event, uint64_t firstCycle, uint64_t cycles, int64_t windowStart, int64_t windowEnd) const
+{
+    //Same fraction of the way through this run as through the host window
+    int64_t offset = std::clamp(event.time, windowStart, windowEnd) - windowStart;
+    uint64_t cycle = firstCycle + static_cast<uint64_t>(static_cast<double>(offset) / (windowEnd - windowStart) * cycles);
+
+    cycle = std::max(cycle, lastCycle);
+    if (!event.down)
+        cycle = std::max(cycle, pressCycle[event.key] + minimumHold);
+    return cycle;
+}
+
+void InputQueue::Run(Chip8& machine, uint64_t cycles)
+{
+    int64_t now = Now();
+    int64_t windowStart = lastRun ? lastRun : now - FIRST_WINDOW;
+    int64_t windowEnd = std::max(now, windowStart + 1);
+    lastRun = now;
+    if (cycles == 0)
+        return; //Nothing to place events on, they wait for the next run
+
+    uint64_t firstCycle = machine.Cycles();
+    uint64_t end = firstCycle + cycles;
+
+    for (;;) {
+        if (!hasNext) {
+            if (!queue.TryPop(next))
+                break;
+            hasNext = true;
+            nextCycle = Schedule(next, firstCycle, cycles, windowStart, windowEnd);
+        }
+        if (nextCycle >= end)
+            break; //Due in a later run, everything after it waits too
+
+        if (nextCycle > machine.Cycles())
+            machine.Run(nextCycle - machine.Cycles());
+        machine.keypad[next.key] = next.down;
+        if (recorder)
+            recorder->RecordKeys(machine);
+        if (next.down)
+            pressCycle[next.key] = machine.Cycles();
+        lastCycle = machine.Cycles();
+        hasNext = false;
+    }
+
+    if (machine.Cycles() < end)
+        machine.Run(end - machine.Cycles());
+}
@@ -0,0 +1,579 @@
+#include <jit.hpp>
+#include <decode.hpp>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(_M_X64)) && (defined(__unix__) || defined(__APPLE__))
+#define CHIP8_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define CHIP8_JIT_SUPPORTED 0
+#endif
+
+namespace {
+
+const size_t ARENA_SIZE = 4 << 20;
+const int MAX_BLOCK_LENGTH = 64;
+const size_t MAX_BLOCK_BYTES = 64 * MAX_BLOCK_LENGTH; //Generous bound on code emitted per block
+const size_t MAX_INSTRUCTION_BYTES = 512; //FX55 with X = F plus the block epilogue, the longest translation
+
+//Registers used by generated code, all caller-saved in the System V ABI
+//rdi holds the Chip8 pointer for the whole block
+enum Reg : uint8_t { EAX = 0, ECX = 1, EDX = 2, ESI = 6 };
+
+class Emitter {
+
+public:
+    explicit Emitter(uint8_t* out) : code(out) {}
+
+    size_t Size() const
+        {return size;}
+
+    void Byte(uint8_t b)
+        {code[size++] = b;}
+
+    void Word(uint16_t w)
+        {Byte(w & 0xFF); Byte(w >> 8);}
+
+    void Dword(uint32_t d)
+        {Word(d & 0xFFFF); Word(d >> 16);}
+
+    void Qword(uint64_t q)
+        {Dword(static_cast<uint32_t>(q)); Dword(static_cast<uint32_t>(q >> 32));}
+
+    void PatchByte(size_t at, uint8_t b)
+        {code[at] = b;}
+
+    void PatchDword(size_t at, uint32_t d)
+        {memcpy(code + at, &d, sizeof(d));}
+
+    //[rdi + disp32] operand with the given reg field
+    void Field(uint8_t reg, int32_t disp)
+        {Byte(0x80 | (reg << 3) | 7); Dword(static_cast<uint32_t>(disp));}
+
+    void LoadByte(Reg r, int32_t disp)      //mov r8, [rdi+disp]
+        {Byte(0x8A); Field(r, disp);}
+
+    void StoreByte(int32_t disp, Reg r)     //mov [rdi+disp], r8
+        {Byte(0x88); Field(r, disp);}
+
+    void StoreByteImm(int32_t disp, uint8_t imm) //mov byte [rdi+disp], imm8
+        {Byte(0xC6); Field(0, disp); Byte(imm);}
+
+    void StoreWordImm(int32_t disp, uint16_t imm) //mov word [rdi+disp], imm16
+        {Byte(0x66); Byte(0xC7); Field(0, disp); Word(imm);}
+
+    void StoreWord(int32_t disp, Reg r)     //mov [rdi+disp], r16
+        {Byte(0x66); Byte(0x89); Field(r, disp);}
+
+    void LoadByteZx(Reg r, int32_t disp)    //movzx r32, byte [rdi+disp]
+        {Byte(0x0F); Byte(0xB6); Field(r, disp);}
+
+    void LoadWordZx(Reg r, int32_t disp)    //movzx r32, word [rdi+disp]
+        {Byte(0x0F); Byte(0xB7); Field(r, disp);}
+
+    void WrapAddress(Reg base, uint8_t offset) //lea edx, [base+offset], and edx, 0xFFF
+        {Byte(0x8D); Byte(0x50 | base); Byte(offset); Byte(0x81); Byte(0xE2); Dword(0xFFF);}
+
+    void MemoryByte(uint8_t op, Reg r, int32_t disp) //op r8, [rdi+rdx+disp] or op [rdi+rdx+disp], r8
+        {Byte(op); Byte(0x84 | (r << 3)); Byte(0x17); Dword(static_cast<uint32_t>(disp));}
+
+    void AluByte(uint8_t op, Reg r, int32_t disp) //op [rdi+disp], r8 or op r8, [rdi+disp]
+        {Byte(op); Field(r, disp);}
+
+    void MovImm(Reg r, uint32_t imm)        //mov r32, imm32
+        {Byte(0xB8 + r); Dword(imm);}
+
+    //rsp is 8 off 16-byte alignment on entry, the push realigns it for the call and keeps rdi
+    void Call(uint64_t target)
+    {
+        Byte(0x48); Byte(0xB8); Qword(target);      //mov rax, imm64
+        Byte(0x57);                                 //push rdi
+        Byte(0xFF); Byte(0xD0);                     //call rax
+        Byte(0x5F);                                 //pop rdi
+    }
+
+    void Ret()
+        {Byte(0xC3);}
+
+    //Takes the block's length off the budget, or puts it back and returns when the budget can't cover it
+    //The length isn't known yet, the result is where PatchPrologue writes it
+    size_t Prologue(int32_t budget)
+    {
+        Byte(0x48); Byte(0x81); Field(5, budget); Dword(0); //sub qword [budget], length
+        Byte(0x73); Byte(12);                               //jae past the ret
+        Byte(0x48); Byte(0x81); Field(0, budget); Dword(0); //add qword [budget], length
+        Ret();
+        return Size();
+    }
+
+    void PatchPrologue(size_t end, uint32_t length)
+        {PatchDword(end - 18, length); PatchDword(end - 5, length);}
+
+    //Jumps to the block whose chain entry is stored at slot, or returns when there is none
+    void Chain(uint64_t slot)
+    {
+        Byte(0x48); Byte(0xB8); Qword(slot);        //mov rax, imm64
+        Byte(0x48); Byte(0x8B); Byte(0x00);         //mov rax, [rax]
+        ChainTo();
+    }
+
+    //Same for the slot of the block at the pc in eax, slots are stride bytes apart
+    void ChainIndexed(uint64_t slots, uint8_t stride)
+    {
+        Byte(0x3D); Dword(4096);                    //cmp eax, 4096
+        Byte(0x73); Byte(24);                       //jae to the ret, no block past the end of memory
+        Byte(0x6B); Byte(0xC0); Byte(stride);       //imul eax, eax, stride
+        Byte(0x48); Byte(0xBA); Qword(slots);       //mov rdx, imm64
+        Byte(0x48); Byte(0x8B); Byte(0x04); Byte(0x02); //mov rax, [rdx+rax]
+        ChainTo();
+    }
+
+private:
+    void ChainTo()
+    {
+        Byte(0x48); Byte(0x85); Byte(0xC0);         //test rax, rax
+        Byte(0x74); Byte(0x02);                     //jz to the ret
+        Byte(0xFF); Byte(0xE0);                     //jmp rax, the return address stays the caller's
+        Ret();
+    }
+
+    uint8_t* code;
+    size_t size = 0;
+};
+
+//Instructions emitted as a call to the interpreter from inside a block
+bool Helper(Op op)
+{
+    switch (op)
+    {
+        case Op::Rnd: case Op::JpV0:
+            return true;
+        default:
+            return false;
+    }
+}
+
+//Instructions the translator handles natively or through a helper; anything else ends the block
+bool Translatable(Op op)
+{
+    if (Helper(op))
+        return true;
+
+    switch (op)
+    {
+        case Op::Jp: case Op::Call: case Op::Ret: case Op::Cls:
+        case Op::SeImm: case Op::SneImm: case Op::SeReg: case Op::SneReg:
+        case Op::Skp: case Op::Sknp:
+        case Op::LdImm: case Op::AddImm: case Op::LdReg:
+        case Op::Or: case Op::And: case Op::Xor:
+        case Op::AddReg: case Op::Sub: case Op::Shr: case Op::Subn: case Op::Shl:
+        case Op::LdI: case Op::LdVxDt: case Op::LdDtVx: case Op::LdStVx:
+        case Op::AddIVx: case Op::LdFVx: case Op::Nop:
+        case Op::Drw: case Op::LdBVx: case Op::StoreRegs: case Op::LoadRegs:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool EndsBlock(Op op)
+{
+    switch (op)
+    {
+        case Op::Jp: case Op::Call: case Op::Ret:
+        case Op::SeImm: case Op::SneImm: case Op::SeReg: case Op::SneReg:
+        case Op::Skp: case Op::Sknp:
+        case Op::JpV0:
+        case Op::LdBVx: case Op::StoreRegs: //May rewrite the block they are in
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
+#if CHIP8_JIT_SUPPORTED
+
+JitCache::JitCache()
+{
+    void* memory = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory != MAP_FAILED)
+        arena = static_cast<uint8_t*>(memory);
+}
+
+JitCache::~JitCache()
+{
+    if (arena)
+        munmap(arena, ARENA_SIZE);
+}
+
+#else
+
+JitCache::JitCache() {}
+JitCache::~JitCache() {}
+
+#endif
+
+void JitCache::Flush()
+{
+    arenaUsed = 0;
+    memset(blocks, 0, sizeof(blocks));
+    memset(covered, 0, sizeof(covered));
+    compiledCount = 0;
+}
+
+void JitCache::Drop(uint16_t address)
+{
+    Block& block = blocks[address];
+    for (uint32_t i = address; i < block.end; ++i)
+        --covered[i];
+    block = {};
+}
+
+void JitCache::Invalidate(uint16_t address, uint16_t length)
+{
+    uint32_t first = address > 0 ? address - 1 : 0;
+    uint32_t last = address + length < 4096 ? address + length : 4096;
+
+    //Most stores land in data, one pass over the counts settles those
+    uint8_t hit = 0;
+    for (uint32_t i = address; i < last; ++i)
+        hit |= covered[i];
+    if (!hit)
+        return;
+
+    //Drop only the blocks translated from the written bytes, their code stays in the arena until the next flush
+    for (size_t i = 0; i < compiledCount; ) {
+        uint16_t start = compiled[i];
+        if (start < last && blocks[start].end > address) {
+            Drop(start);
+            compiled[i] = compiled[--compiledCount];
+        }
+        else
+            ++i;
+    }
+
+    //Interpreter markers for the changed bytes have to be decoded again
+    for (uint32_t i = first; i < last; ++i) {
+        if (blocks[i].state == Interpret)
+            Drop(static_cast<uint16_t>(i));
+    }
+}
+
+static_assert(sizeof(JitCache::Block) < 128, "ChainIndexed() scales pc by an imm8 stride");
+
+void JitCache::Compile(uint16_t address, const uint8_t* memory, const JitLayout& layout)
+{
+    if (arena && arenaUsed + MAX_BLOCK_BYTES > ARENA_SIZE)
+        Flush();
+
+    //Until a translation finishes the address is an interpreter marker, which covers the opcode's bytes like a block
+    Block& block = blocks[address];
+    uint16_t end = address + 2 < 4096 ? address + 2 : 4096;
+    block = {nullptr, nullptr, 0, Interpret, 0, end};
+    for (uint32_t i = address; i < end; ++i)
+        ++covered[i];
+
+    if (!arena)
+        return;
+
+    const Instruction* table = DecodeTable();
+
+    Emitter e(arena + arenaUsed);
+    size_t prologue = e.Prologue(layout.budget);
+    uint16_t pc = address;
+    int length = 0;
+    bool terminated = false;
+    uint16_t lastOpcode = 0;
+
+    //Stores the next pc and goes on to its block, an idle loop jump returns so the caller can cut it short
+    auto exitTo = [&](uint16_t target, bool chain) {
+        e.StoreWordImm(layout.pc, target);
+        if (chain && target < 4096)
+            e.Chain(reinterpret_cast<uint64_t>(&blocks[target].chain));
+        else
+            e.Ret();
+    };
+    auto exitIndexed = [&]() { //pc in eax
+        e.ChainIndexed(reinterpret_cast<uint64_t>(&blocks[0].chain), sizeof(Block));
+    };
+
+    while (length < MAX_BLOCK_LENGTH && pc + 1 < 4096 && e.Size() + MAX_INSTRUCTION_BYTES <= MAX_BLOCK_BYTES) {
+        const Instruction& in = table[memory[pc] << 8 | memory[pc + 1]];
+        if (!Translatable(in.op))
+            break;
+
+        int32_t vx = layout.registers + in.x;
+        int32_t vy = layout.registers + in.y;
+        int32_t vf = layout.registers + 0xF;
+        lastOpcode = in.opcode;
+        ++length;
+
+        if (Helper(in.op)) {
+            //The interpreter steps from the guest pc, so store it first
+            e.StoreWordImm(layout.pc, pc);
+            e.Call(reinterpret_cast<uint64_t>(layout.step));
+            pc += 2;
+            if (EndsBlock(in.op)) {
+                e.LoadWordZx(EAX, layout.pc); //pc and opcode are already set by the interpreter
+                exitIndexed();
+                e.PatchPrologue(prologue, length);
+                Finish(block, address, pc, length, e.Size());
+                block.chain = block.fn;
+                return;
+            }
+            continue;
+        }
+
+        switch (in.op)
+        {
+            case Op::Nop:
+                break;
+
+            case Op::Cls:
+                e.Call(reinterpret_cast<uint64_t>(layout.clear));
+                break;
+
+            case Op::LdImm:
+                e.StoreByteImm(vx, in.nn);
+                break;
+
+            case Op::AddImm:
+                e.Byte(0x80); e.Field(0, vx); e.Byte(in.nn); //add byte [vx], nn
+                break;
+
+            case Op::LdReg:
+                e.LoadByte(EAX, vy);
+                e.StoreByte(vx, EAX);
+                break;
+
+            case Op::Or:
+            case Op::And:
+            case Op::Xor:
+                e.LoadByte(EAX, vy);
+                e.AluByte(in.op == Op::Or ? 0x08 : in.op == Op::And ? 0x20 : 0x30, EAX, vx);
+                break;
+
+            case Op::AddReg:
+                e.LoadByte(EAX, vx);
+                e.AluByte(0x02, EAX, vy);                   //add al, [vy]
+                e.Byte(0x0F); e.Byte(0x92); e.Byte(0xC1);   //setc cl
+                e.StoreByte(vx, EAX);
+                e.StoreByte(vf, ECX);
+                break;
+
+            case Op::Sub:
+            case Op::Subn:
+                e.LoadByte(EAX, in.op == Op::Sub ? vx : vy);
+                e.AluByte(0x2A, EAX, in.op == Op::Sub ? vy : vx); //sub al, [..]
+                e.Byte(0x0F); e.Byte(0x93); e.Byte(0xC1);   //setnc cl, no borrow
+                e.StoreByte(vx, EAX);
+                e.StoreByte(vf, ECX);
+                break;
+
+            case Op::Shr:
+                e.LoadByte(EAX, layout.shiftVx ? vx : vy);
+                e.Byte(0x88); e.Byte(0xC1);                 //mov cl, al
+                e.Byte(0x80); e.Byte(0xE1); e.Byte(0x01);   //and cl, 1
+                e.Byte(0xD0); e.Byte(0xE8);                 //shr al, 1
+                e.StoreByte(vx, EAX);
+                e.StoreByte(vf, ECX);
+                break;
+
+            case Op::Shl:
+                e.LoadByte(EAX, layout.shiftVx ? vx : vy);
+                e.Byte(0x88); e.Byte(0xC1);                 //mov cl, al
+                e.Byte(0xC0); e.Byte(0xE9); e.Byte(0x07);   //shr cl, 7
+                e.Byte(0x00); e.Byte(0xC0);                 //add al, al
+                e.StoreByte(vx, EAX);
+                e.StoreByte(vf, ECX);
+                break;
+
+            case Op::LdI:
+                e.StoreWordImm(layout.I, in.nnn);
+                break;
+
+            case Op::LdVxDt:
+                e.LoadByte(EAX, layout.delayTimer);
+                e.StoreByte(vx, EAX);
+                break;
+
+            case Op::LdDtVx:
+            case Op::LdStVx:
+                e.LoadByte(EAX, vx);
+                e.StoreByte(in.op == Op::LdDtVx ? layout.delayTimer : layout.soundTimer, EAX);
+                break;
+
+            case Op::AddIVx:
+                e.LoadByteZx(EAX, vx);
+                e.Byte(0x66); e.Byte(0x01); e.Field(EAX, layout.I); //add [I], ax
+                break;
+
+            case Op::LdFVx:
+                e.LoadByteZx(EAX, vx);
+                e.Byte(0x8D); e.Byte(0x44); e.Byte(0x80); e.Byte(0x50); //lea eax, [rax+rax*4+0x50]
+                e.StoreWord(layout.I, EAX);
+                break;
+
+            case Op::Drw:
+                //Draws straight from the operands, no fetch or decode, and the block goes on
+                e.MovImm(ESI, in.x);
+                e.MovImm(EDX, in.y);
+                e.MovImm(ECX, in.nn & 0xF);
+                e.Call(reinterpret_cast<uint64_t>(layout.draw));
+                break;
+
+            case Op::LoadRegs:
+            case Op::StoreRegs:
+                //One byte per register, each address wrapping at the end of memory like the interpreter's
+                e.LoadWordZx(EAX, layout.I);
+                for (uint8_t i = 0; i <= in.x; ++i) {
+                    e.WrapAddress(EAX, i);
+                    if (in.op == Op::LoadRegs) {
+                        e.MemoryByte(0x8A, ECX, layout.memory); //mov cl, [memory+rdx]
+                        e.StoreByte(layout.registers + i, ECX);
+                    }
+                    else {
+                        e.LoadByte(ECX, layout.registers + i);
+                        e.MemoryByte(0x88, ECX, layout.memory); //mov [memory+rdx], cl
+                    }
+                }
+                if (in.op == Op::StoreRegs) {
+                    e.Byte(0x89); e.Byte(0xC6);                 //mov esi, eax
+                    e.MovImm(EDX, in.x + 1);
+                    e.Call(reinterpret_cast<uint64_t>(layout.invalidate));
+                }
+                if (layout.incrementI) {
+                    e.Byte(0x66); e.Byte(0x83); e.Field(0, layout.I); e.Byte(in.x + 1); //add word [I], x + 1
+                }
+                break;
+
+            case Op::LdBVx:
+                //Digits by multiply and shift, exact for the byte range: v * 41 >> 12 is v / 100, r * 205 >> 11 is r / 10
+                e.LoadByteZx(EAX, vx);
+                e.Byte(0x6B); e.Byte(0xC8); e.Byte(41);     //imul ecx, eax, 41
+                e.Byte(0xC1); e.Byte(0xE9); e.Byte(12);     //shr ecx, 12
+                e.Byte(0x6B); e.Byte(0xF1); e.Byte(100);    //imul esi, ecx, 100
+                e.Byte(0x29); e.Byte(0xF0);                 //sub eax, esi
+                e.LoadWordZx(ESI, layout.I);
+                e.WrapAddress(ESI, 0);
+                e.MemoryByte(0x88, ECX, layout.memory);     //hundreds
+                e.Byte(0x69); e.Byte(0xC8); e.Dword(205);   //imul ecx, eax, 205
+                e.Byte(0xC1); e.Byte(0xE9); e.Byte(11);     //shr ecx, 11
+                e.WrapAddress(ESI, 1);
+                e.MemoryByte(0x88, ECX, layout.memory);     //tens
+                e.Byte(0x6B); e.Byte(0xC9); e.Byte(10);     //imul ecx, ecx, 10
+                e.Byte(0x29); e.Byte(0xC8);                 //sub eax, ecx
+                e.WrapAddress(ESI, 2);
+                e.MemoryByte(0x88, EAX, layout.memory);     //ones
+                e.MovImm(EDX, 3);
+                e.Call(reinterpret_cast<uint64_t>(layout.invalidate));
+                break;
+
+            case Op::Jp:
+                e.StoreWordImm(layout.opcode, in.opcode);
+                exitTo(in.nnn, in.nnn != pc && in.nnn + 4 != pc); //Shapes IdleLoopLength() may match
+                terminated = true;
+                break;
+
+            case Op::Call:
+                e.LoadByteZx(EAX, layout.sp);
+                //mov word [rdi+rax*2+stack], pc
+                e.Byte(0x66); e.Byte(0xC7); e.Byte(0x84); e.Byte(0x47); e.Dword(layout.stack); e.Word(pc);
+                e.Byte(0xFE); e.Field(0, layout.sp);        //inc byte [sp]
+                e.Byte(0x80); e.Field(4, layout.sp); e.Byte(0x0F); //and byte [sp], 15, the stack wraps
+                e.StoreWordImm(layout.opcode, in.opcode);
+                exitTo(in.nnn, true);
+                terminated = true;
+                break;
+
+            case Op::Ret:
+                e.Byte(0xFE); e.Field(1, layout.sp);        //dec byte [sp]
+                e.Byte(0x80); e.Field(4, layout.sp); e.Byte(0x0F); //and byte [sp], 15
+                e.LoadByteZx(EAX, layout.sp);
+                //movzx eax, word [rdi+rax*2+stack]
+                e.Byte(0x0F); e.Byte(0xB7); e.Byte(0x84); e.Byte(0x47); e.Dword(layout.stack);
+                e.Byte(0x83); e.Byte(0xC0); e.Byte(0x02);   //add eax, 2
+                e.StoreWord(layout.pc, EAX);
+                e.StoreWordImm(layout.opcode, in.opcode);
+                exitIndexed();
+                terminated = true;
+                break;
+
+            case Op::SeImm:
+            case Op::SneImm:
+            case Op::SeReg:
+            case Op::SneReg:
+            case Op::Skp:
+            case Op::Sknp:
+            {
+                e.StoreWordImm(layout.opcode, in.opcode);
+                if (in.op == Op::SeImm || in.op == Op::SneImm) {
+                    e.Byte(0x80); e.Field(7, vx); e.Byte(in.nn); //cmp byte [vx], nn
+                }
+                else if (in.op == Op::SeReg || in.op == Op::SneReg) {
+                    e.LoadByte(EDX, vx);
+                    e.AluByte(0x3A, EDX, vy);               //cmp dl, [vy]
+                }
+                else {
+                    e.LoadByteZx(EDX, vx);
+                    e.Byte(0x83); e.Byte(0xE2); e.Byte(0x0F);   //and edx, 15, the low nibble names the key
+                    //cmp byte [rdi+rdx+keypad], 0
+                    e.Byte(0x80); e.Byte(0xBC); e.Byte(0x17); e.Dword(layout.keypad); e.Byte(0);
+                }
+                //Skip on equal for SE and on not-equal for SNE, SKP skips when the key is non-zero
+                //Each side gets its own exit, so each jumps straight to its block
+                bool skipOnEqual = in.op == Op::SeImm || in.op == Op::SeReg || in.op == Op::Sknp;
+                e.Byte(skipOnEqual ? 0x74 : 0x75); e.Byte(0);   //je/jne to the skip
+                size_t skip = e.Size();
+                exitTo(pc + 2, true);
+                e.PatchByte(skip - 1, static_cast<uint8_t>(e.Size() - skip));
+                exitTo(pc + 4, true);
+                terminated = true;
+                break;
+            }
+
+            default:
+                break;
+        }
+
+        pc += 2;
+        if (terminated || EndsBlock(in.op))
+            break; //Memory stores leave pc to the epilogue
+    }
+
+    if (length == 0)
+        return; //First instruction needs the interpreter
+
+    if (!terminated) {
+        e.StoreWordImm(layout.opcode, lastOpcode);
+        exitTo(pc, true);
+    }
+    e.PatchPrologue(prologue, length);
+
+    //A block opening with a jump IdleLoopLength() may match is only entered from the caller
+    uint16_t first = memory[address] << 8 | memory[address + 1];
+    uint16_t target = first & 0x0FFF;
+    bool idleJump = (first & 0xF000) == 0x1000 && (target == address || target + 4 == address);
+    Finish(block, address, pc, length, e.Size());
+    if (!idleJump)
+        block.chain = block.fn;
+}
+
+void JitCache::Finish(Block& block, uint16_t address, uint16_t end, int length, size_t codeSize)
+{
+    for (uint32_t i = address; i < block.end; ++i)
+        --covered[i]; //The marker's
+
+    block.fn = reinterpret_cast<BlockFn>(arena + arenaUsed);
+    block.length = static_cast<uint16_t>(length);
+    block.state = Compiled;
+    block.end = end;
+    arenaUsed += codeSize;
+
+    for (uint32_t i = address; i < end; ++i)
+        ++covered[i];
+    compiled[compiledCount++] = address;
+}
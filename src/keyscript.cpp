@@ -0,0 +1,53 @@
+#include <keyscript.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+bool KeyScript::Load(const std::filesystem::path& filename)
+{
+    std::ifstream script(filename);
+    if (!script.is_open())
+        return false;
+
+    events.clear();
+    next = 0;
+
+    std::string line;
+    while (std::getline(script, line)) {
+        //Strip comments
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream fields(line);
+        uint64_t frame;
+        std::string key, state;
+        if (!(fields >> frame >> key >> state))
+            continue; //Blank or malformed line
+
+        char* end = nullptr;
+        unsigned long value = std::strtoul(key.c_str(), &end, 16);
+        if (*end != '\0' || value > 0xF)
+            return false;
+
+        if (state != "down" && state != "up")
+            return false;
+
+        events.push_back({frame, static_cast<uint8_t>(value), state == "down"});
+    }
+
+    //Events are applied in frame order, keep same-frame events in file order
+    std::stable_sort(events.begin(), events.end(),
+        [](const KeyEvent& a, const KeyEvent& b) { return a.frame < b.frame; });
+    return true;
+}
+
+void KeyScript::Apply(uint64_t frame, uint8_t* keypad)
+{
+    while (next < events.size() && events[next].frame <= frame) {
+        keypad[events[next].key] = events[next].down ? 1 : 0;
+        ++next;
+    }
+}
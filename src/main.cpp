@@ -1,21 +1,140 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
 #include <SDL2/SDL.h>
+#include <beeper.hpp>
 #include <chip8.hpp>
-
-#define ON_COLOR 0xDC143CFF //True Crimson
-#define OFF_COLOR 0x1E1E1EFF //Graphite Grey
+#include <frame_capture.hpp>
+#include <input_queue.hpp>
+#include <movie.hpp>
+#include <rewind.hpp>
+#include <rom_cache.hpp>
+#include <trace_ring.hpp>
+#include <triple_buffer.hpp>
 
 const int SCREEN_WIDTH = 64;
 const int SCREEN_HEIGHT = 32;
 const int SCALE = 12;
 const int INSTRUCTIONS_PER_FRAME = 15;
+const size_t DEFAULT_REWIND_MB = 16;
+const int AUDIO_RATE = 48000;
+const int AUDIO_BUFFER = 512; //Samples per callback, about 11 ms
+const std::chrono::microseconds FRAME_DURATION(16667); //60 Hz guest clock in threaded mode
+const std::chrono::microseconds FAST_FORWARD_BUDGET(12000); //Emulation time per drawn frame when fast-forwarding
+const int FAST_FORWARD_CHECK = 16; //Guest frames between clock reads while fast-forwarding
+const char WINDOW_TITLE[] = "CHIP-8 Emulator";
+
+using DisplayRows = std::array<uint64_t, SCREEN_HEIGHT>;
+
+//Host key for each CHIP-8 key 0-F, the 4x4 block from 1 to V
+const SDL_Keycode KEY_MAP[16] = {
+     SDLK_x, SDLK_1, SDLK_2, SDLK_3,
+     SDLK_q, SDLK_w, SDLK_e, SDLK_a,
+     SDLK_s, SDLK_d, SDLK_z, SDLK_c,
+     SDLK_4, SDLK_r, SDLK_f, SDLK_v,
+};
+
+enum StateRequest { NO_REQUEST, SAVE_REQUEST, LOAD_REQUEST };
+
+static void PrintUsage(const char* program)
+{
+     std::cerr << "Usage: " << program << " <ROM file> [--rewind-mb N] [--profile FILE] [--threaded] [--capture FILE] [--capture-scale N] [--record FILE] [--quirks chip8|vip|chip48|schip] [--trace FILE] [--trace-size N] [--fast-forward] [--speed N|max]" << std::endl;
+}
+
+static bool ParseCount(const char* text, uint64_t& out)
+{
+     char* end = nullptr;
+     out = std::strtoull(text, &end, 10);
+     return *text != '\0' && *end == '\0';
+}
 
 int main(int argc, char* argv[])  {
 
-     if (argc < 2) {
-          std::cerr << "Usage: " << argv[0] << " <ROM file>" << std::endl;
-          return 1;
+     if (argc < 2 || std::string(argv[1]) == "--help" || std::string(argv[1]) == "-h") {
+          PrintUsage(argv[0]);
+          return argc < 2 ? 1 : 0;
+     }
+
+     uint64_t rewindMegabytes = DEFAULT_REWIND_MB;
+     std::filesystem::path profilePath;
+     bool threaded = false; //Emulate on a separate thread at a fixed clock, render on the main thread
+     std::filesystem::path capturePath;
+     uint64_t captureScale = 1;
+     std::filesystem::path recordPath;
+     QuirkProfile quirks = QuirkProfile::Chip8;
+     bool quirksGiven = false; //Otherwise looked up in roms/quirks.txt
+     std::filesystem::path tracePath;
+     uint64_t traceSize = 1 << 16;
+     bool fastForwardAtStart = false;
+     unsigned fastForwardSpeed = 0; //Guest speed while fast-forwarding as a multiple of 60 Hz, 0 for as fast as possible
+     for (int i = 2; i < argc; ++i) {
+          std::string arg = argv[i];
+          bool hasValue = i + 1 < argc;
+
+          if (arg == "--rewind-mb" && hasValue && ParseCount(argv[i + 1], rewindMegabytes) && rewindMegabytes <= SIZE_MAX >> 20) {
+               ++i;
+          }
+          else if (arg == "--profile" && hasValue) {
+#ifdef CHIP8_PROFILE
+               profilePath = argv[++i];
+#else
+               std::cerr << "--profile needs a build configured with -DCHIP8_PROFILE=ON" << std::endl;
+               return 1;
+#endif
+          }
+          else if (arg == "--threaded") {
+               threaded = true;
+          }
+          else if (arg == "--capture" && hasValue) {
+               capturePath = argv[++i];
+          }
+          else if (arg == "--capture-scale" && hasValue && ParseCount(argv[i + 1], captureScale) && captureScale > 0) {
+               ++i;
+          }
+          else if (arg == "--record" && hasValue) {
+               recordPath = argv[++i];
+          }
+          else if (arg == "--quirks" && hasValue) {
+               if (!ParseQuirkProfile(argv[++i], quirks)) {
+                    std::cerr << "Unknown quirk profile: " << argv[i] << std::endl;
+                    return 1;
+               }
+               quirksGiven = true;
+          }
+          else if (arg == "--trace" && hasValue) {
+               tracePath = argv[++i];
+          }
+          else if (arg == "--trace-size" && hasValue && ParseCount(argv[i + 1], traceSize) && traceSize > 0) {
+               ++i;
+          }
+          else if (arg == "--fast-forward") {
+               fastForwardAtStart = true;
+          }
+          else if (arg == "--speed" && hasValue) {
+               //max is the uncapped default, a number is a multiple of 60 Hz
+               std::string value = argv[++i];
+               uint64_t speed = 0;
+               if (value != "max" && !(ParseCount(value.c_str(), speed) && speed > 0 && speed <= 1000)) {
+                    std::cerr << "--speed takes max or a multiple of 60 Hz from 1 to 1000: " << value << std::endl;
+                    PrintUsage(argv[0]);
+                    return 1;
+               }
+               fastForwardSpeed = static_cast<unsigned>(speed);
+          }
+          else {
+               std::cerr << "Unknown option or bad value: " << arg << std::endl;
+               PrintUsage(argv[0]);
+               return 1;
+          }
      }
 
      std::filesystem::path romPath = argv[1];
@@ -28,108 +147,350 @@ int main(int argc, char* argv[])  {
      }
 
      std::cout << "Loading ROM from: " << romPath << std::endl;
+     std::filesystem::path statePath = romPath;
+     statePath += ".state";
      
      Chip8 chip8;
      chip8.Initialize();
-     chip8.LoadROM(romPath);
+     if (!chip8.LoadROM(romPath))
+          return 1;
+     uint64_t romHash = RomCache::Shared().Load(romPath)->Hash();
+     chip8.SetQuirks(quirksGiven ? quirks : LookupQuirks(romPath, romHash));
+     if (chip8.GetQuirks() != QuirkProfile::Chip8)
+          std::cout << "Quirk profile: " << QuirkProfileName(chip8.GetQuirks()) << std::endl;
+
+     RewindBuffer rewind(rewindMegabytes * 1024 * 1024);
+
+     //A movie replays from power-on, so rewinding and loading states are off while recording
+     bool recording = !recordPath.empty();
+     InputMovie movie;
+     if (recording) {
+          uint32_t seed = std::random_device{}();
+          chip8.SeedRandom(seed);
+          movie.Start(chip8, romHash, seed, INSTRUCTIONS_PER_FRAME);
+     }
+
+     //Last instructions before a crash, or before SIGUSR1 for a look at a running session
+     std::unique_ptr<TraceRing> trace;
+     if (!tracePath.empty()) {
+          trace = std::make_unique<TraceRing>(std::min<uint64_t>(traceSize, 1 << 26));
+          if (!trace->InstallSignalHandlers(tracePath))
+               std::cerr << "Trace dumps on signals are not available here, writing at exit only" << std::endl;
+          chip8.SetTrace(trace.get());
+     }
+
+     //Every displayed frame goes to the capture writer thread, including rewound ones
+     FrameCapture capture(ON_COLOR, OFF_COLOR, static_cast<int>(std::min<uint64_t>(captureScale, 16)));
+     if (!capturePath.empty() && !capture.Open(capturePath))
+          return 1;
 
      if (SDL_Init(SDL_INIT_VIDEO) < 0) {
           std::cerr << "SDL could not initialize. SDL_Error: " << SDL_GetError() << std::endl;
           return 1;
      }
 
-     SDL_Window *window = SDL_CreateWindow("CHIP-8 Emulator",  //Initialize SDL, window creation
+     //Sound is optional, the emulator runs silent if there is no audio device
+     Beeper beeper(AUDIO_RATE, AUDIO_BUFFER);
+     SDL_AudioDeviceID audio = 0;
+     if (SDL_InitSubSystem(SDL_INIT_AUDIO) == 0) {
+          SDL_AudioSpec want{};
+          want.freq = AUDIO_RATE;
+          want.format = AUDIO_F32SYS;
+          want.channels = 1;
+          want.samples = AUDIO_BUFFER;
+          want.callback = [](void* userdata, Uint8* stream, int length) {
+               static_cast<Beeper*>(userdata)->Render(reinterpret_cast<float*>(stream), length / sizeof(float));
+          };
+          want.userdata = &beeper;
+          audio = SDL_OpenAudioDevice(nullptr, 0, &want, nullptr, 0); //SDL converts if the device differs
+     }
+     if (audio == 0)
+          std::cerr << "No audio device, running without sound. SDL_Error: " << SDL_GetError() << std::endl;
+     else
+          SDL_PauseAudioDevice(audio, 0);
+
+     SDL_Window *window = SDL_CreateWindow(WINDOW_TITLE,  //Initialize SDL, window creation
           SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 
           SCREEN_WIDTH * SCALE, SCREEN_HEIGHT * SCALE, 
           SDL_WINDOW_SHOWN);
      //Handles window drawing
-     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1,  SDL_RENDERER_ACCELERATED);
+     //Vsync can only stall the render thread when emulation runs on its own
+     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1,  SDL_RENDERER_ACCELERATED | (threaded ? SDL_RENDERER_PRESENTVSYNC : 0));
 
      SDL_Texture *texture = SDL_CreateTexture(renderer, //Texture to hold pixel data, RGBA8888 format
           SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STREAMING,
           SCREEN_WIDTH, SCREEN_HEIGHT);
 
+     //Input thread to emulation. Keys are applied at the guest cycle matching their time and held for
+     //at least a frame's worth of cycles, the rest is applied at the start of the next frame
+     InputQueue input(INSTRUCTIONS_PER_FRAME);
+     if (recording)
+          input.SetRecorder(&movie);
+     std::atomic<bool> rewinding{false}; //Backspace held
+     std::atomic<int> stateRequest{NO_REQUEST};
+     std::atomic<bool> fastForward{fastForwardAtStart}; //Tab toggles
+
+     //Emulation to renderer, the newest finished frame
+     TripleBuffer<DisplayRows> display;
+     std::atomic<bool> frameEventPending{false};
+     std::atomic<uint64_t> guestFrames{0}; //For the speed shown in the title
+
+     bool toneOn = false;
+     auto emulateFrame = [&]() {
+          switch (stateRequest.exchange(NO_REQUEST)) {
+               case SAVE_REQUEST: //Quick save
+                    if (chip8.SaveStateFile(statePath))
+                         std::cout << "Saved state to " << statePath << std::endl;
+                    else
+                         std::cerr << "Could not save state to " << statePath << std::endl;
+                    break;
+               case LOAD_REQUEST: //Quick load
+                    if (recording)
+                         std::cerr << "Loading states is disabled while recording" << std::endl;
+                    else if (chip8.LoadStateFile(statePath))
+                         std::cout << "Loaded state from " << statePath << std::endl;
+                    else
+                         std::cerr << "Could not load state from " << statePath << std::endl;
+                    break;
+          }
+
+          bool back = rewinding.load(std::memory_order_relaxed) && !recording;
+          if (back) {
+               rewind.Pop(chip8); //Steps back one frame, stays on the oldest once history runs out
+          }
+          else {
+               //Timers tick once per frame of guest cycles, so they keep guest time at any speed
+               input.Run(chip8, INSTRUCTIONS_PER_FRAME);
+               chip8.TickTimers();
+               if (recording)
+                    movie.RecordFrame(chip8);
+               else
+                    rewind.Push(chip8);
+          }
+
+          capture.Submit(chip8.gfx);
+
+          guestFrames.fetch_add(1, std::memory_order_relaxed);
+
+          //Beeps at many times the rate would just buzz
+          bool tone = chip8.SoundActive() && !back && !fastForward.load(std::memory_order_relaxed);
+          if (tone != toneOn) {
+               beeper.SetTone(tone);
+               toneOn = tone;
+          }
+
+          if (chip8.TakeDirtyRows()) {
+               std::copy(chip8.gfx, chip8.gfx + SCREEN_HEIGHT, display.WriteBuffer().begin());
+               display.Publish();
+               //Wake the render thread, at most one wake-up event in flight
+               if (threaded && !frameEventPending.exchange(true)) {
+                    SDL_Event wake{};
+                    wake.type = SDL_USEREVENT;
+                    SDL_PushEvent(&wake);
+               }
+          }
+     };
+
+     std::atomic<bool> quit{false};
+     std::thread emulation;
+     if (threaded) {
+          emulation = std::thread([&]() {
+               auto deadline = std::chrono::steady_clock::now();
+               while (!quit.load(std::memory_order_relaxed)) {
+                    emulateFrame();
+                    //Read once, Tab on the main thread may flip it between two loads
+                    bool ff = fastForward.load(std::memory_order_relaxed);
+                    //Vsync presents the newest frame, so fast-forward skips frames here without counting them
+                    if (ff && fastForwardSpeed == 0) {
+                         deadline = std::chrono::steady_clock::now();
+                         continue;
+                    }
+                    deadline += ff && fastForwardSpeed != 0 ? FRAME_DURATION / fastForwardSpeed : FRAME_DURATION;
+                    auto now = std::chrono::steady_clock::now();
+                    if (now - deadline > 4 * FRAME_DURATION)
+                         deadline = now; //Fell far behind (suspended or debugged), don't race to catch up
+                    std::this_thread::sleep_until(deadline);
+               }
+          });
+     }
+
      bool running = true;
+     bool windowDirty = true; //Texture is still blank, or the window needs repainting
      SDL_Event event;
+     uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT]; //CHIP-8 graphics buffer to SDL pixel buffer
+     DisplayRows shown{}; //Rows in the texture
+     uint32_t staleRows = 0xFFFFFFFF; //Texture starts out undefined
+     auto titleTime = std::chrono::steady_clock::now();
+     uint64_t titleFrames = 0;
+     uint64_t drawnFrames = 0; //Host frames since the title was last updated
+     bool titleShowsSpeed = false;
 
-     uint32_t lastTimerUpdate = SDL_GetTicks();
-
-     while (running) { //Main emulation loop
+     while (running) { //Main loop: input, emulation unless threaded, rendering
           while (SDL_PollEvent(&event)) { //Input handling, check SDL events
                if (event.type == SDL_QUIT) {
                     running = false;
                }
-               else if (event.type == SDL_KEYDOWN) {
-                    switch (event.key.keysym.sym) {
-                         case SDLK_x: chip8.keypad[0x0] = 1; break;
-                         case SDLK_1: chip8.keypad[0x1] = 1; break;
-                         case SDLK_2: chip8.keypad[0x2] = 1; break;
-                         case SDLK_3: chip8.keypad[0x3] = 1; break;
-                         case SDLK_q: chip8.keypad[0x4] = 1; break;
-                         case SDLK_w: chip8.keypad[0x5] = 1; break;
-                         case SDLK_e: chip8.keypad[0x6] = 1; break;
-                         case SDLK_a: chip8.keypad[0x7] = 1; break;
-                         case SDLK_s: chip8.keypad[0x8] = 1; break;
-                         case SDLK_d: chip8.keypad[0x9] = 1; break;
-                         case SDLK_z: chip8.keypad[0xA] = 1; break;
-                         case SDLK_c: chip8.keypad[0xB] = 1; break;
-                         case SDLK_4: chip8.keypad[0xC] = 1; break;
-                         case SDLK_r: chip8.keypad[0xD] = 1; break;
-                         case SDLK_f: chip8.keypad[0xE] = 1; break;
-                         case SDLK_v: chip8.keypad[0xF] = 1; break;
-                    }
+               else if (event.type == SDL_WINDOWEVENT) {
+                    windowDirty = true;
+               }
+               else if (event.type == SDL_USEREVENT) {
+                    frameEventPending.store(false);
                }
-               else if (event.type == SDL_KEYUP) {
-                    switch (event.key.keysym.sym) {
-                         case SDLK_x: chip8.keypad[0x0] = 0; break;
-                         case SDLK_1: chip8.keypad[0x1] = 0; break;
-                         case SDLK_2: chip8.keypad[0x2] = 0; break;
-                         case SDLK_3: chip8.keypad[0x3] = 0; break;
-                         case SDLK_q: chip8.keypad[0x4] = 0; break;
-                         case SDLK_w: chip8.keypad[0x5] = 0; break;
-                         case SDLK_e: chip8.keypad[0x6] = 0; break;
-                         case SDLK_a: chip8.keypad[0x7] = 0; break;
-                         case SDLK_s: chip8.keypad[0x8] = 0; break;
-                         case SDLK_d: chip8.keypad[0x9] = 0; break;
-                         case SDLK_z: chip8.keypad[0xA] = 0; break;
-                         case SDLK_c: chip8.keypad[0xB] = 0; break;
-                         case SDLK_4: chip8.keypad[0xC] = 0; break;
-                         case SDLK_r: chip8.keypad[0xD] = 0; break;
-                         case SDLK_f: chip8.keypad[0xE] = 0; break;
-                         case SDLK_v: chip8.keypad[0xF] = 0; break;
+               else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && !event.key.repeat) {
+                    bool down = event.type == SDL_KEYDOWN;
+                    SDL_Keycode sym = event.key.keysym.sym;
+                    //SDL stamps events in milliseconds, move that onto the input queue's clock
+                    int64_t time = InputQueue::Now() - static_cast<int64_t>(SDL_GetTicks() - event.key.timestamp) * 1000000;
+
+                    for (uint8_t key = 0; key < 16; ++key) {
+                         if (KEY_MAP[key] == sym)
+                              input.Push(key, down, time);
                     }
+                    if (sym == SDLK_BACKSPACE)
+                         rewinding.store(down);
+                    else if (sym == SDLK_F5 && down)
+                         stateRequest.store(SAVE_REQUEST);
+                    else if (sym == SDLK_F9 && down)
+                         stateRequest.store(LOAD_REQUEST);
+                    else if (sym == SDLK_TAB && down)
+                         fastForward.store(!fastForward.load());
+               }
+          }
+
+          auto frameStart = std::chrono::steady_clock::now();
+          if (!threaded && fastForward && !rewinding) {
+               //Run the frames the speed asks for, or as many as fit in the budget, and draw only the last.
+               //The clock is read every few frames so a cost jump (a busy scene after an idle intro) can't
+               //overrun the budget by much, which makes the number of skipped frames adapt on its own
+               uint64_t target = fastForwardSpeed ? fastForwardSpeed : UINT64_MAX;
+               auto budgetEnd = frameStart + FAST_FORWARD_BUDGET;
+               for (uint64_t frame = 0; frame < target; ++frame) {
+                    emulateFrame();
+                    if (chip8.IsIdleUntilKey() && !input.HasPending())
+                         break; //Further frames can't change anything
+                    if (frame % FAST_FORWARD_CHECK == FAST_FORWARD_CHECK - 1 && std::chrono::steady_clock::now() >= budgetEnd)
+                         break;
+               }
+          }
+          else if (!threaded) {
+               emulateFrame();
+          }
+          ++drawnFrames;
+
+          //Achieved guest speed in the title while fast-forwarding, refreshed twice a second
+          auto titleAge = frameStart - titleTime;
+          if (titleAge >= std::chrono::milliseconds(500)) {
+               uint64_t frames = guestFrames.load(std::memory_order_relaxed);
+               double speed = (frames - titleFrames) / (std::chrono::duration<double>(titleAge).count() * 60.0);
+               if (fastForward) {
+                    char title[96];
+                    if (threaded)
+                         std::snprintf(title, sizeof(title), "%s - %.1fx", WINDOW_TITLE, speed);
+                    else
+                         std::snprintf(title, sizeof(title), "%s - %.1fx, drawing 1 of %.0f frames", WINDOW_TITLE, speed,
+                                       std::max(1.0, static_cast<double>(frames - titleFrames) / drawnFrames));
+                    SDL_SetWindowTitle(window, title);
+                    titleShowsSpeed = true;
+               }
+               else if (titleShowsSpeed) {
+                    SDL_SetWindowTitle(window, WINDOW_TITLE);
+                    titleShowsSpeed = false;
                }
+               titleTime = frameStart;
+               titleFrames = frames;
+               drawnFrames = 0;
           }
 
-          for (int i = 0; i < INSTRUCTIONS_PER_FRAME; ++i) {
-               chip8.EmulateCycle();
+          //Only convert and upload the band of rows that changed, skip the present on static frames
+          if (display.Read()) {
+               const DisplayRows& rows = display.ReadBuffer();
+               for (int row = 0; row < SCREEN_HEIGHT; ++row) {
+                    if (rows[row] != shown[row])
+                         staleRows |= 1u << row;
+               }
+               shown = rows;
           }
+          if (staleRows) {
+               int firstRow = 0;
+               while (!(staleRows & (1u << firstRow)))
+                    ++firstRow;
+               int lastRow = SCREEN_HEIGHT - 1;
+               while (!(staleRows & (1u << lastRow)))
+                    --lastRow;
+               int rowCount = lastRow - firstRow + 1;
 
-          uint32_t currentTicks = SDL_GetTicks();
-          if (currentTicks - lastTimerUpdate >= 1000 /60 ) { //16ms
-               chip8.TickTimers();
-               lastTimerUpdate = currentTicks;
+               uint32_t* band = pixels + firstRow * SCREEN_WIDTH;
+               Chip8::ExpandRows(shown.data(), band, ON_COLOR, OFF_COLOR, firstRow, rowCount);
+               //Update texture with pixel data
+               SDL_Rect rect = {0, firstRow, SCREEN_WIDTH, rowCount};
+               SDL_UpdateTexture(texture, &rect, band, SCREEN_WIDTH * sizeof(uint32_t));
+               staleRows = 0;
+               windowDirty = true;
+          }
+
+          if (windowDirty) {
+               //Render the updated texture to the window
+               SDL_RenderClear(renderer);
+               SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+               SDL_RenderPresent(renderer);
+               windowDirty = false;
           }
 
-          uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT]; //CHIP-8 graphics buffer to SDL pixel buffer
-          for (int i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; ++i) {
-               pixels[i] = chip8.gfx[i] ? ON_COLOR : OFF_COLOR; 
+          if (threaded) {
+               SDL_WaitEventTimeout(nullptr, 100); //New frames arrive as SDL_USEREVENT
+          }
+          else if (chip8.IsIdleUntilKey() && !rewinding && !input.HasPending()) {
+               SDL_WaitEvent(nullptr); //Only a key can change the machine, sleep until input arrives
+          }
+          else if (fastForward && !rewinding) {
+               //A set speed sleeps off the rest of the 60 Hz host frame, uncapped goes straight on
+               auto left = std::chrono::duration_cast<std::chrono::milliseconds>(frameStart + FRAME_DURATION - std::chrono::steady_clock::now());
+               if (fastForwardSpeed && left.count() > 0)
+                    SDL_Delay(static_cast<Uint32>(left.count()));
+          }
+          else if (chip8.IsIdle()) {
+               SDL_WaitEventTimeout(nullptr, 16); //Nothing changes before the next timer tick, but wake for input
+          }
+          else {
+               SDL_Delay(16); //60 fps: 1000ms / 60 = 16ms
           }
-          //Update texture with pixel data
-          SDL_UpdateTexture(texture, nullptr, pixels, SCREEN_WIDTH * sizeof(uint32_t));
-          //Render the updated texture to the window
-          SDL_RenderClear(renderer);
-          SDL_RenderCopy(renderer, texture, nullptr, nullptr);
-          SDL_RenderPresent(renderer);
 
-          SDL_Delay(16); //60 fps: 1000ms / 60 = 16ms
+     }
+     quit.store(true);
+     if (emulation.joinable())
+          emulation.join();
 
+     if (recording) {
+          if (movie.Save(recordPath))
+               std::cout << "Recorded " << movie.Frames() << " frames to " << recordPath << std::endl;
+          else
+               std::cerr << "Could not write movie to " << recordPath << std::endl;
+     }
+     if (trace) {
+          if (trace->Dump(tracePath))
+               std::cout << "Wrote the last " << std::min<uint64_t>(trace->Total(), trace->Capacity()) << " instructions to " << tracePath << std::endl;
+          else
+               std::cerr << "Could not write trace to " << tracePath << std::endl;
      }
+     if (!capturePath.empty() && capture.Close())
+          std::cout << "Captured " << capture.Written() << " frames to " << capturePath << ", dropped " << capture.Dropped() << std::endl;
+
      //Clean up
+     if (audio != 0)
+          SDL_CloseAudioDevice(audio);
      SDL_DestroyTexture(texture);
      SDL_DestroyRenderer(renderer);
      SDL_DestroyWindow(window);
      SDL_Quit();
 
+#ifdef CHIP8_PROFILE
+     if (!profilePath.empty()) {
+          if (chip8.GetProfile().Write(profilePath))
+               std::cout << "Wrote profile to " << profilePath << std::endl;
+          else
+               std::cerr << "Could not write profile to " << profilePath << std::endl;
+     }
+#endif
+
      return 0;
 }
@@ -0,0 +1,237 @@
+#include <movie.hpp>
+#include <fstream>
+#include <iterator>
+
+namespace {
+
+const char MAGIC[4] = {'C', '8', 'M', 'V'};
+const uint8_t VERSION = 2; //Version 1 had no quirk profile and always ran as chip8
+
+void PutVarint(std::vector<uint8_t>& out, uint64_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void PutFixed(std::vector<uint8_t>& out, uint64_t value, int bytes) //Little endian
+{
+    for (int i = 0; i < bytes; ++i)
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+}
+
+//Bounds-checked reader over a loaded file, fails sticky once it runs past the end
+struct Reader {
+    const std::vector<uint8_t>& data;
+    size_t offset = 0;
+    bool ok = true;
+
+    uint64_t Fixed(int bytes)
+    {
+        uint64_t value = 0;
+        if (offset + bytes > data.size()) {
+            ok = false;
+            return 0;
+        }
+        for (int i = 0; i < bytes; ++i)
+            value |= static_cast<uint64_t>(data[offset++]) << (8 * i);
+        return value;
+    }
+    uint64_t Varint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (offset >= data.size())
+                break;
+            uint8_t byte = data[offset++];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        ok = false;
+        return 0;
+    }
+};
+
+}
+
+uint16_t InputMovie::KeyMask(const Chip8& machine)
+{
+    uint16_t keys = 0;
+    for (int key = 0; key < 16; ++key) {
+        if (machine.keypad[key])
+            keys |= 1 << key;
+    }
+    return keys;
+}
+
+void InputMovie::SetKeys(Chip8& machine, uint16_t keys)
+{
+    for (int key = 0; key < 16; ++key)
+        machine.keypad[key] = (keys >> key) & 1;
+}
+
+void InputMovie::Start(const Chip8& machine, uint64_t romHash, uint32_t seed, uint32_t instructionsPerFrame)
+{
+    this->romHash = romHash;
+    this->seed = seed;
+    quirks = machine.GetQuirks();
+    this->instructionsPerFrame = instructionsPerFrame;
+    initialKeys = lastKeys = KeyMask(machine);
+    startCycle = machine.Cycles();
+    events.clear();
+    frameHashes.clear();
+}
+
+void InputMovie::RecordKeys(const Chip8& machine)
+{
+    uint16_t keys = KeyMask(machine);
+    if (keys == lastKeys)
+        return;
+
+    uint64_t cycle = machine.Cycles() - startCycle;
+    if (!events.empty() && events.back().cycle == cycle)
+        events.back().keys = keys; //Same instant, only the final keypad matters
+    else
+        events.push_back({cycle, keys});
+    lastKeys = keys;
+}
+
+void InputMovie::RecordFrame(const Chip8& machine)
+{
+    frameHashes.push_back(machine.DisplayHash());
+}
+
+bool InputMovie::Replay(Chip8& machine, uint64_t& divergedFrame) const
+{
+    machine.SeedRandom(seed);
+    machine.SetQuirks(quirks);
+    SetKeys(machine, initialKeys);
+    uint64_t start = machine.Cycles();
+
+    //Same split as the recording: run up to each key change, then to the frame end and tick
+    size_t next = 0;
+    for (uint64_t frame = 0; frame < frameHashes.size(); ++frame) {
+        uint64_t end = (frame + 1) * instructionsPerFrame;
+        while (next < events.size() && events[next].cycle < end) {
+            uint64_t now = machine.Cycles() - start;
+            if (events[next].cycle > now)
+                machine.Run(events[next].cycle - now);
+            SetKeys(machine, events[next].keys);
+            ++next;
+        }
+        machine.Run(end - (machine.Cycles() - start));
+        machine.TickTimers();
+
+        if (machine.DisplayHash() != frameHashes[frame]) {
+            divergedFrame = frame;
+            return false;
+        }
+    }
+    return true;
+}
+
+//"C8MV", version, ROM hash, seed, quirk profile, instructions per frame, initial keys,
+//key changes as [cycle delta][changed bits], frame hashes as [run length][hash]
+bool InputMovie::Save(const std::filesystem::path& filepath) const
+{
+    if (frameHashes.size() > MAX_FRAMES)
+        return false;
+
+    std::vector<uint8_t> out(MAGIC, MAGIC + sizeof(MAGIC));
+    out.push_back(VERSION);
+    PutFixed(out, romHash, 8);
+    PutFixed(out, seed, 4);
+    PutFixed(out, static_cast<uint8_t>(quirks), 1);
+    PutFixed(out, instructionsPerFrame, 4);
+    PutFixed(out, initialKeys, 2);
+
+    PutVarint(out, events.size());
+    uint64_t cycle = 0;
+    uint16_t keys = initialKeys;
+    for (const Event& event : events) {
+        PutVarint(out, event.cycle - cycle);
+        PutFixed(out, event.keys ^ keys, 2);
+        cycle = event.cycle;
+        keys = event.keys;
+    }
+
+    PutVarint(out, frameHashes.size());
+    for (size_t frame = 0; frame < frameHashes.size();) {
+        size_t run = 1;
+        while (frame + run < frameHashes.size() && frameHashes[frame + run] == frameHashes[frame])
+            ++run;
+        PutVarint(out, run);
+        PutFixed(out, frameHashes[frame], 8);
+        frame += run;
+    }
+
+    std::ofstream file(filepath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+    file.write(reinterpret_cast<const char*>(out.data()), out.size());
+    return file.good();
+}
+
+bool InputMovie::Load(const std::filesystem::path& filepath)
+{
+    std::ifstream file(filepath, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Reader in{data};
+    for (char c : MAGIC) {
+        if (in.Fixed(1) != static_cast<uint8_t>(c))
+            return false;
+    }
+    uint64_t version = in.Fixed(1);
+    if (version < 1 || version > VERSION)
+        return false;
+
+    uint64_t hash = in.Fixed(8);
+    uint32_t movieSeed = static_cast<uint32_t>(in.Fixed(4));
+    uint64_t profile = version >= 2 ? in.Fixed(1) : 0;
+    if (profile > static_cast<uint8_t>(QuirkProfile::Schip))
+        return false;
+    uint32_t ipf = static_cast<uint32_t>(in.Fixed(4));
+    uint16_t keys = static_cast<uint16_t>(in.Fixed(2));
+    uint16_t firstKeys = keys;
+
+    //Counts come from the file, grow as entries actually parse rather than reserving them up front
+    std::vector<Event> parsedEvents;
+    uint64_t eventCount = in.Varint();
+    uint64_t cycle = 0;
+    for (uint64_t i = 0; i < eventCount && in.ok; ++i) {
+        cycle += in.Varint();
+        keys ^= static_cast<uint16_t>(in.Fixed(2));
+        parsedEvents.push_back({cycle, keys});
+    }
+
+    //A run expands to that many hashes in memory, so a corrupt count must not get to allocate
+    std::vector<uint64_t> parsedHashes;
+    uint64_t frameCount = in.Varint();
+    if (frameCount > MAX_FRAMES)
+        return false;
+    while (parsedHashes.size() < frameCount && in.ok) {
+        uint64_t run = in.Varint();
+        uint64_t frameHash = in.Fixed(8);
+        if (!in.ok || run == 0 || run > frameCount - parsedHashes.size())
+            return false;
+        parsedHashes.insert(parsedHashes.end(), run, frameHash);
+    }
+
+    if (!in.ok || in.offset != data.size() || ipf == 0)
+        return false;
+
+    romHash = hash;
+    seed = movieSeed;
+    quirks = static_cast<QuirkProfile>(profile);
+    instructionsPerFrame = ipf;
+    initialKeys = firstKeys;
+    events = std::move(parsedEvents);
+    frameHashes = std::move(parsedHashes);
+    return true;
+}
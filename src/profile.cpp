@@ -0,0 +1,118 @@
+#include <profile.hpp>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+const size_t MAX_FRAMES = 4096; //Deeper or more varied call paths are counted in the caller
+
+Profile::Profile()
+{
+    Reset();
+}
+
+void Profile::Reset()
+{
+    instructions = draws = collisions = wraps = 0;
+    for (uint64_t& hits : pcHits)
+        hits = 0;
+    for (uint64_t& hits : depthHits)
+        hits = 0;
+    frames.assign(1, Frame{0x200, 0, 0, 0, 0, {}});
+    current = 0;
+}
+
+uint32_t Profile::Enter(uint16_t entry, uint8_t depth)
+{
+    uint32_t* link = &frames[current].child;
+    while (*link != 0) {
+        if (frames[*link].entry == entry)
+            return *link;
+        link = &frames[*link].sibling;
+    }
+    if (frames.size() >= MAX_FRAMES)
+        return current;
+
+    uint32_t index = static_cast<uint32_t>(frames.size());
+    *link = index; //Taken before push_back, which may move the frames
+    frames.push_back(Frame{entry, depth, current, 0, 0, {}});
+    return index;
+}
+
+static std::string FrameName(uint16_t entry, bool root)
+{
+    char name[16];
+    snprintf(name, sizeof(name), root ? "main" : "sub_%03x", entry);
+    return name;
+}
+
+bool Profile::WriteFolded(const std::filesystem::path& filepath) const
+{
+    std::ofstream file(filepath);
+
+    //Depth-first over the call tree, carrying the path so far
+    std::vector<std::pair<uint32_t, std::string>> pending{{0, FrameName(0x200, true)}};
+    while (!pending.empty()) {
+        auto [index, path] = pending.back();
+        pending.pop_back();
+
+        const Frame& frame = frames[index];
+        for (uint8_t op = 0; op < static_cast<uint8_t>(Op::Count); ++op) {
+            if (frame.ops[op])
+                file << path << ';' << OpName(static_cast<Op>(op)) << ' ' << frame.ops[op] << '\n';
+        }
+        for (uint32_t child = frame.child; child != 0; child = frames[child].sibling)
+            pending.emplace_back(child, path + ';' + FrameName(frames[child].entry, false));
+    }
+    return static_cast<bool>(file);
+}
+
+bool Profile::WriteJson(const std::filesystem::path& filepath) const
+{
+    std::ofstream file(filepath);
+
+    uint64_t opCounts[static_cast<uint8_t>(Op::Count)]{};
+    for (const Frame& frame : frames) {
+        for (uint8_t op = 0; op < static_cast<uint8_t>(Op::Count); ++op)
+            opCounts[op] += frame.ops[op];
+    }
+
+    file << "{\n  \"instructions\": " << instructions << ",\n  \"ops\": {";
+    const char* separator = "";
+    for (uint8_t op = 0; op < static_cast<uint8_t>(Op::Count); ++op) {
+        if (opCounts[op]) {
+            file << separator << "\n    \"" << OpName(static_cast<Op>(op)) << "\": " << opCounts[op];
+            separator = ",";
+        }
+    }
+
+    file << "\n  },\n  \"pc\": {";
+    separator = "";
+    for (uint16_t pc = 0; pc < 4096; ++pc) {
+        if (pcHits[pc]) {
+            char address[8];
+            snprintf(address, sizeof(address), "%03x", pc);
+            file << separator << "\n    \"" << address << "\": " << pcHits[pc];
+            separator = ",";
+        }
+    }
+
+    uint8_t maxDepth = 0;
+    for (uint8_t depth = 0; depth < 17; ++depth) {
+        if (depthHits[depth])
+            maxDepth = depth;
+    }
+    file << "\n  },\n  \"call_depth\": {\n    \"max\": " << static_cast<int>(maxDepth) << ",\n    \"histogram\": [";
+    for (uint8_t depth = 0; depth <= maxDepth; ++depth)
+        file << (depth ? ", " : "") << depthHits[depth];
+
+    file << "]\n  },\n  \"draw\": {\n"
+         << "    \"calls\": " << draws << ",\n"
+         << "    \"collisions\": " << collisions << ",\n"
+         << "    \"wraps\": " << wraps << "\n  }\n}\n";
+    return static_cast<bool>(file);
+}
+
+bool Profile::Write(const std::filesystem::path& filepath) const
+{
+    return filepath.extension() == ".folded" ? WriteFolded(filepath) : WriteJson(filepath);
+}
@@ -0,0 +1,104 @@
+#include <quirks.hpp>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+const struct {
+    const char* name;
+    QuirkProfile profile;
+} PROFILE_NAMES[] = {
+    {"chip8", QuirkProfile::Chip8},
+    {"vip", QuirkProfile::Vip},
+    {"chip48", QuirkProfile::Chip48},
+    {"schip", QuirkProfile::Schip},
+};
+
+}
+
+bool ParseQuirkProfile(const std::string& name, QuirkProfile& profile)
+{
+    for (const auto& entry : PROFILE_NAMES) {
+        if (name == entry.name) {
+            profile = entry.profile;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* QuirkProfileName(QuirkProfile profile)
+{
+    for (const auto& entry : PROFILE_NAMES) {
+        if (profile == entry.profile)
+            return entry.name;
+    }
+    return "chip8";
+}
+
+bool QuirkDatabase::Load(const std::filesystem::path& filename)
+{
+    std::ifstream database(filename);
+    if (!database.is_open())
+        return false;
+
+    byHash.clear();
+    byName.clear();
+
+    std::string line;
+    while (std::getline(database, line)) {
+        //Strip comments
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+
+        std::istringstream fields(line);
+        std::string rom, name;
+        if (!(fields >> rom >> name))
+            continue; //Blank line
+
+        QuirkProfile profile;
+        if (!ParseQuirkProfile(name, profile))
+            return false;
+
+        //Sixteen hex digits are a content hash, anything else a file name
+        char* end = nullptr;
+        uint64_t value = std::strtoull(rom.c_str(), &end, 16);
+        if (rom.size() == 16 && *end == '\0')
+            byHash[value] = profile;
+        else
+            byName[rom] = profile;
+    }
+    return true;
+}
+
+bool QuirkDatabase::Find(uint64_t romHash, const std::filesystem::path& romPath, QuirkProfile& profile) const
+{
+    auto hashed = byHash.find(romHash);
+    if (hashed != byHash.end()) {
+        profile = hashed->second;
+        return true;
+    }
+    auto named = byName.find(romPath.filename().string());
+    if (named != byName.end()) {
+        profile = named->second;
+        return true;
+    }
+    return false;
+}
+
+QuirkProfile LookupQuirks(const std::filesystem::path& romPath, uint64_t romHash)
+{
+    std::filesystem::path databasePath = romPath.parent_path() / "quirks.txt";
+    QuirkDatabase database;
+    QuirkProfile profile = QuirkProfile::Chip8;
+    if (std::filesystem::exists(databasePath)) {
+        if (!database.Load(databasePath))
+            std::cerr << "Ignoring unreadable quirk database: " << databasePath << std::endl;
+        else
+            database.Find(romHash, romPath, profile);
+    }
+    return profile;
+}
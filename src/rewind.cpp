@@ -0,0 +1,195 @@
+#include <rewind.hpp>
+#include <cstring>
+
+namespace {
+
+size_t PutVarint(uint8_t* out, size_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = static_cast<uint8_t>(value) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = static_cast<uint8_t>(value);
+    return n;
+}
+
+size_t GetVarint(const uint8_t* in, size_t& value)
+{
+    size_t n = 0;
+    int shift = 0;
+    value = 0;
+    do {
+        value |= static_cast<size_t>(in[n] & 0x7F) << shift;
+        shift += 7;
+    } while (in[n++] & 0x80);
+    return n;
+}
+
+//XOR against base (zeros when base is null), stored as [zero run][literal count][literals]...
+size_t Encode(const uint8_t* state, const uint8_t* base, size_t size, uint8_t* out)
+{
+    size_t n = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t zeros = i;
+        while (i < size && state[i] == (base ? base[i] : 0))
+            ++i;
+        zeros = i - zeros;
+
+        //A literal run ends at the first pair of unchanged bytes, single ones are cheaper inline
+        size_t start = i;
+        while (i < size && !(state[i] == (base ? base[i] : 0) &&
+               (i + 1 == size || state[i + 1] == (base ? base[i + 1] : 0))))
+            ++i;
+
+        n += PutVarint(out + n, zeros);
+        n += PutVarint(out + n, i - start);
+        for (size_t j = start; j < i; ++j)
+            out[n++] = state[j] ^ (base ? base[j] : 0);
+    }
+    return n;
+}
+
+//state holds the base on entry and the decoded frame on return
+void Decode(const uint8_t* in, size_t size, uint8_t* state)
+{
+    size_t n = 0;
+    size_t position = 0;
+    while (n < size) {
+        size_t zeros, literals;
+        n += GetVarint(in + n, zeros);
+        n += GetVarint(in + n, literals);
+        position += zeros;
+        for (size_t j = 0; j < literals; ++j)
+            state[position++] ^= in[n++];
+    }
+}
+
+}
+
+RewindBuffer::RewindBuffer(size_t budgetBytes, uint32_t keyframeInterval)
+    : ring(budgetBytes),
+      records(budgetBytes / 64 + 1), //Caps history at one frame per 64 bytes of budget
+      interval(keyframeInterval > 0 ? keyframeInterval : 1),
+      current(Chip8::STATE_SIZE),
+      keyframe(Chip8::STATE_SIZE),
+      encoded(Chip8::STATE_SIZE * 2 + 16)
+{
+}
+
+void RewindBuffer::Clear()
+{
+    first = count = head = bytesUsed = 0;
+    keyframeAge = SIZE_MAX;
+}
+
+void RewindBuffer::EvictOldest()
+{
+    bytesUsed -= At(0).size;
+    first = (first + 1) % records.size();
+    --count;
+    if (keyframeAge != SIZE_MAX)
+        keyframeAge = keyframeAge > 0 ? keyframeAge - 1 : SIZE_MAX;
+}
+
+size_t RewindBuffer::NewestKeyframe()
+{
+    for (size_t age = count; age > 0; --age) {
+        if (At(age - 1).keyframe)
+            return age - 1;
+    }
+    return count;
+}
+
+size_t RewindBuffer::Reserve(size_t size)
+{
+    if (count == records.size())
+        EvictOldest();
+
+    if (head + size > ring.size()) {
+        //Records between head and the end are the oldest, the leftover gap is not worth keeping them for
+        while (count > 0 && At(0).offset >= head)
+            EvictOldest();
+        head = 0;
+    }
+
+    //Going forward from head, the oldest record comes first
+    while (count > 0 && At(0).offset < head + size && At(0).offset + At(0).size > head)
+        EvictOldest();
+
+    //Deltas are useless once their keyframe is gone
+    while (count > 0 && !At(0).keyframe)
+        EvictOldest();
+
+    size_t offset = head;
+    head += size;
+    return offset;
+}
+
+void RewindBuffer::Push(const Chip8& chip8)
+{
+    chip8.SaveState(current.data(), current.size());
+
+    size_t key = NewestKeyframe();
+    bool isKeyframe = key == count || count - key >= interval;
+
+    if (!isKeyframe && keyframeAge != key) {
+        //Decode the keyframe this delta will be relative to
+        memset(keyframe.data(), 0, keyframe.size());
+        Decode(&ring[At(key).offset], At(key).size, keyframe.data());
+        keyframeAge = key;
+    }
+
+    size_t size = Encode(current.data(), isKeyframe ? nullptr : keyframe.data(), current.size(), encoded.data());
+    if (size > ring.size())
+        return; //Budget smaller than one frame
+
+    size_t offset = Reserve(size);
+    if (!isKeyframe && count == 0) {
+        head = 0;
+        return; //Reserve had to drop the keyframe, the next frame starts a new one
+    }
+    memcpy(&ring[offset], encoded.data(), size);
+
+    if (isKeyframe) {
+        memcpy(keyframe.data(), current.data(), current.size());
+        keyframeAge = count;
+    }
+
+    records[(first + count) % records.size()] = {offset, static_cast<uint32_t>(size), isKeyframe};
+    ++count;
+    bytesUsed += size;
+}
+
+bool RewindBuffer::Pop(Chip8& chip8)
+{
+    if (count == 0)
+        return false;
+
+    size_t newest = count - 1;
+    const Record& record = At(newest);
+
+    if (record.keyframe) {
+        memset(current.data(), 0, current.size());
+    }
+    else {
+        size_t key = NewestKeyframe();
+        if (keyframeAge != key) {
+            memset(keyframe.data(), 0, keyframe.size());
+            Decode(&ring[At(key).offset], At(key).size, keyframe.data());
+            keyframeAge = key;
+        }
+        memcpy(current.data(), keyframe.data(), current.size());
+    }
+    Decode(&ring[record.offset], record.size, current.data());
+
+    //Writing resumes where the popped record started
+    head = record.offset;
+    bytesUsed -= record.size;
+    --count;
+    if (keyframeAge == newest)
+        keyframeAge = SIZE_MAX;
+
+    return chip8.LoadState(current.data(), current.size());
+}
@@ -0,0 +1,130 @@
+#include <rom_cache.hpp>
+#include <chip8.hpp>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define CHIP8_MMAP 0
+#endif
+
+namespace {
+
+//Read-only view of a whole file, mapped where the platform allows it
+class FileView {
+
+public:
+    explicit FileView(const std::filesystem::path& filepath, size_t size)
+        : size(size)
+    {
+#if CHIP8_MMAP
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        if (size > 0) {
+            void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+                data = static_cast<const uint8_t*>(mapped);
+        }
+        else {
+            data = reinterpret_cast<const uint8_t*>(""); //Empty files can't be mapped
+        }
+        close(fd);
+#else
+        std::ifstream file(filepath, std::ios::binary);
+        fallback.resize(size);
+        if (file.read(reinterpret_cast<char*>(fallback.data()), size))
+            data = fallback.data();
+#endif
+    }
+    ~FileView()
+    {
+#if CHIP8_MMAP
+        if (data && size > 0)
+            munmap(const_cast<uint8_t*>(data), size);
+#endif
+    }
+    FileView(const FileView&) = delete;
+    FileView& operator=(const FileView&) = delete;
+
+    const uint8_t* data = nullptr;
+    size_t size;
+
+private:
+#if !CHIP8_MMAP
+    std::vector<uint8_t> fallback;
+#endif
+};
+
+uint64_t HashBytes(const uint8_t* data, size_t size)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+}
+
+RomCache& RomCache::Shared()
+{
+    static RomCache cache;
+    return cache;
+}
+
+void RomCache::Clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    byPath.clear();
+    byHash.clear();
+}
+
+std::shared_ptr<const RomImage> RomCache::Load(const std::filesystem::path& filepath)
+{
+    std::error_code sizeError, timeError;
+    uintmax_t size = std::filesystem::file_size(filepath, sizeError);
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(filepath, timeError);
+    if (sizeError || timeError) {
+        std::cerr << "Could not open ROM: " << filepath << std::endl;
+        return nullptr;
+    }
+    if (size > RomImage::MAX_ROM_SIZE) {
+        std::cerr << "ROM is " << size << " bytes, the most that fits at 0x200 is " << RomImage::MAX_ROM_SIZE << ": " << filepath << std::endl;
+        return nullptr;
+    }
+
+    std::string key = filepath.lexically_normal().string();
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto cached = byPath.find(key);
+    if (cached != byPath.end() && cached->second.size == size && cached->second.modified == modified)
+        return cached->second.image;
+
+    FileView view(filepath, static_cast<size_t>(size));
+    if (!view.data) {
+        std::cerr << "Could not read ROM: " << filepath << std::endl;
+        return nullptr;
+    }
+
+    uint64_t hash = HashBytes(view.data, view.size);
+    std::shared_ptr<const RomImage>& shared = byHash[hash];
+    if (!shared || shared->Size() != view.size || memcmp(shared->Memory() + 0x200, view.data, view.size) != 0) {
+        auto image = std::make_shared<RomImage>();
+        Chip8::CopyFontset(image->memory);
+        memcpy(image->memory + 0x200, view.data, view.size);
+        image->size = view.size;
+        image->hash = hash;
+        shared = image; //A hash collision just replaces the older image
+    }
+
+    byPath[key] = PathEntry{shared, modified, size};
+    return shared;
+}
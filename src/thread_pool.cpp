@@ -0,0 +1,89 @@
+#include <thread_pool.hpp>
+
+WorkStealingPool::WorkStealingPool(size_t threads)
+    : queues(threads > 0 ? threads : 1)
+{
+    for (size_t i = 0; i < queues.size(); ++i)
+        workers.emplace_back(&WorkStealingPool::Worker, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        stopping = true;
+    }
+    workAvailable.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void WorkStealingPool::Submit(Task task)
+{
+    //Deal tasks round-robin, stealing evens out whatever imbalance is left
+    Queue& queue = queues[nextQueue++ % queues.size()];
+    {
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> guard(stateLock);
+        ++pending;
+        ++queued;
+    }
+    workAvailable.notify_one();
+}
+
+void WorkStealingPool::Wait()
+{
+    std::unique_lock<std::mutex> guard(stateLock);
+    allDone.wait(guard, [this] { return pending == 0; });
+}
+
+bool WorkStealingPool::PopLocal(size_t index, Task& task)
+{
+    Queue& queue = queues[index];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty())
+        return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::Steal(size_t thief, Task& task)
+{
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+        Queue& victim = queues[(thief + offset) % queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::Worker(size_t index)
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> guard(stateLock);
+            workAvailable.wait(guard, [this] { return stopping || queued > 0; });
+            if (queued == 0)
+                return; //Stopping and nothing left to run
+            --queued; //Claim one task, it is in some deque
+        }
+
+        Task task;
+        while (!PopLocal(index, task) && !Steal(index, task))
+            std::this_thread::yield(); //The claimed task is being pushed right now
+
+        task(index);
+
+        std::lock_guard<std::mutex> guard(stateLock);
+        if (--pending == 0)
+            allDone.notify_all();
+    }
+}
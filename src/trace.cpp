@@ -0,0 +1,176 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <decode.hpp>
+#include <trace_ring.hpp>
+
+struct Filter {
+     uint16_t pcLow = 0;
+     uint16_t pcHigh = 0xFFFF;
+     std::string op; //Mnemonic such as DRW, or an Op name such as Drw; empty matches all
+     int reg = -1;   //Only records that wrote this register
+     uint64_t first = 0; //Nonzero keeps the oldest N matches
+     uint64_t last = 0;  //Nonzero keeps the newest N matches
+};
+
+static void PrintUsage(const char* program)
+{
+     std::cerr << "Usage: " << program << " <trace file> [options]\n"
+               << "  --pc A[-B]   Only instructions at address A, or from A to B inclusive (hex)\n"
+               << "  --op NAME    Only one instruction: a mnemonic (DRW, LD, SKP) or a decoder op name (LdI, Drw)\n"
+               << "  --reg N      Only instructions that wrote VN (hex digit)\n"
+               << "  --first N    Print the oldest N matching records\n"
+               << "  --last N     Print the newest N matching records\n";
+}
+
+static bool ParseCount(const char* text, uint64_t& out)
+{
+     char* end = nullptr;
+     out = std::strtoull(text, &end, 10);
+     return *text != '\0' && *end == '\0';
+}
+
+static bool ParseAddress(const char* text, uint16_t& out)
+{
+     char* end = nullptr;
+     unsigned long value = std::strtoul(text, &end, 16);
+     out = static_cast<uint16_t>(value);
+     return *text != '\0' && *end == '\0' && value <= 0xFFFF;
+}
+
+static bool ParseOptions(int argc, char* argv[], Filter& filter)
+{
+     for (int i = 2; i < argc; ++i) {
+          std::string arg = argv[i];
+          bool hasValue = i + 1 < argc;
+
+          if (arg == "--pc" && hasValue) {
+               std::string range = argv[++i];
+               size_t dash = range.find('-');
+               std::string low = range.substr(0, dash);
+               std::string high = dash == std::string::npos ? low : range.substr(dash + 1);
+               if (!ParseAddress(low.c_str(), filter.pcLow) || !ParseAddress(high.c_str(), filter.pcHigh) || filter.pcLow > filter.pcHigh) {
+                    std::cerr << "Bad address range: " << range << std::endl;
+                    return false;
+               }
+          }
+          else if (arg == "--op" && hasValue) {
+               filter.op = argv[++i];
+          }
+          else if (arg == "--reg" && hasValue) {
+               uint16_t reg;
+               if (!ParseAddress(argv[++i], reg) || reg > 0xF) {
+                    std::cerr << "Bad register: " << argv[i] << std::endl;
+                    return false;
+               }
+               filter.reg = reg;
+          }
+          else if (arg == "--first" && hasValue && ParseCount(argv[i + 1], filter.first)) {
+               ++i;
+          }
+          else if (arg == "--last" && hasValue && ParseCount(argv[i + 1], filter.last)) {
+               ++i;
+          }
+          else {
+               PrintUsage(argv[0]);
+               return false;
+          }
+     }
+     return true;
+}
+
+static bool ReadTrace(const char* path, TraceFileHeader& header, std::vector<TraceRecord>& records)
+{
+     std::ifstream file(path, std::ios::binary);
+     if (!file.is_open()) {
+          std::cerr << "Could not open trace: " << path << std::endl;
+          return false;
+     }
+     if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "C8TR", 4) != 0) {
+          std::cerr << "Not a trace file: " << path << std::endl;
+          return false;
+     }
+     if (header.version != 1 || header.recordSize != sizeof(TraceRecord)) {
+          std::cerr << "Unsupported trace version " << header.version << std::endl;
+          return false;
+     }
+
+     //A dump cut short by a crash keeps the records that made it to disk
+     TraceRecord record;
+     while (records.size() < header.count && file.read(reinterpret_cast<char*>(&record), sizeof(record)))
+          records.push_back(record);
+     if (records.size() < header.count)
+          std::cerr << "Trace is truncated, " << records.size() << " of " << header.count << " records" << std::endl;
+     return true;
+}
+
+static bool Matches(const TraceRecord& record, const Filter& filter)
+{
+     if (record.pc < filter.pcLow || record.pc > filter.pcHigh)
+          return false;
+     if (filter.reg >= 0 && record.reg != filter.reg)
+          return false; //Only the lowest written register is recorded, see TraceRecord
+     if (!filter.op.empty()) {
+          std::string text = Disassemble(record.opcode);
+          std::string mnemonic = text.substr(0, text.find(' '));
+          if (filter.op != mnemonic && filter.op != OpName(DecodeOpcode(record.opcode).op))
+               return false;
+     }
+     return true;
+}
+
+static void PrintRecord(const TraceRecord& record)
+{
+     char line[96];
+     std::snprintf(line, sizeof(line), "%10u  %03X  %04X  %-16s I=%03X sp=%X dt=%02X",
+                   static_cast<unsigned>(record.cycle), static_cast<unsigned>(record.pc), static_cast<unsigned>(record.opcode),
+                   Disassemble(record.opcode).c_str(), static_cast<unsigned>(record.I), static_cast<unsigned>(record.sp),
+                   static_cast<unsigned>(record.delayTimer));
+     std::cout << line;
+     if (record.reg != TraceRecord::NO_REGISTER) {
+          std::snprintf(line, sizeof(line), "  V%X=%02X%s", static_cast<unsigned>(record.reg), static_cast<unsigned>(record.value),
+                        record.flags & TraceRecord::MANY_REGISTERS ? " +" : "");
+          std::cout << line;
+     }
+     std::cout << "\n";
+}
+
+int main(int argc, char* argv[]) {
+
+     if (argc < 2) {
+          PrintUsage(argv[0]);
+          return 1;
+     }
+
+     Filter filter;
+     if (!ParseOptions(argc, argv, filter))
+          return 1;
+
+     TraceFileHeader header;
+     std::vector<TraceRecord> records;
+     if (!ReadTrace(argv[1], header, records))
+          return 1;
+
+     std::vector<const TraceRecord*> matched;
+     for (const TraceRecord& record : records) {
+          if (Matches(record, filter))
+               matched.push_back(&record);
+     }
+
+     size_t begin = 0, end = matched.size();
+     if (filter.first > 0 && filter.first < end - begin)
+          end = begin + filter.first;
+     if (filter.last > 0 && filter.last < end - begin)
+          begin = end - filter.last;
+
+     std::cout << "#records: " << records.size() << " of " << header.total << " executed, " << matched.size() << " matching\n"
+               << "#     cycle   pc   op    instruction      state                written\n";
+     for (size_t i = begin; i < end; ++i)
+          PrintRecord(*matched[i]);
+     return 0;
+}
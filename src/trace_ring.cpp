@@ -0,0 +1,175 @@
+#include <trace_ring.hpp>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CHIP8_TRACE_SIGNALS 1
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define CHIP8_TRACE_SIGNALS 0
+#endif
+
+namespace {
+
+#if CHIP8_TRACE_SIGNALS
+const char TRACE_MAGIC[4] = {'C', '8', 'T', 'R'};
+const uint16_t TRACE_VERSION = 1;
+const int CRASH_SIGNALS[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+std::atomic<const TraceRing*> installedRing{nullptr};
+std::atomic<const char*> installedPath{nullptr};
+
+bool WriteAll(int fd, const void* data, size_t size)
+{
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t written = write(fd, bytes, size);
+        if (written <= 0)
+            return false;
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+//Only open, write, close and raise in here, they are async-signal-safe
+void OnSignal(int signal)
+{
+    const TraceRing* ring = installedRing.load();
+    const char* path = installedPath.load();
+    if (ring && path) {
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            ring->DumpTo(fd);
+            close(fd);
+        }
+    }
+
+    if (signal != SIGUSR1) {
+        //Let the default action run, so the crash still ends the process and leaves a core
+        std::signal(signal, SIG_DFL);
+        raise(signal);
+    }
+}
+#endif
+
+}
+
+TraceRing::TraceRing(size_t capacity)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    records = std::make_unique<TraceRecord[]>(size);
+    mask = size - 1;
+}
+
+TraceRing::~TraceRing()
+{
+    RemoveSignalHandlers();
+}
+
+void TraceRing::Clear()
+{
+    head.store(0);
+    lastWritten = WRITES_NONE;
+    pendingValue = &spare;
+}
+
+void TraceRing::Detach()
+{
+    if (machineRegisters)
+        *pendingValue = machineRegisters[lastWritten & 0xF];
+    pendingValue = &spare;
+    machineRegisters = nullptr;
+}
+
+bool TraceRing::DumpTo(int fd) const
+{
+#if CHIP8_TRACE_SIGNALS
+    uint64_t total = head.load(std::memory_order_acquire);
+    uint64_t count = total < mask + 1 ? total : mask + 1;
+
+    TraceFileHeader header{};
+    std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    header.version = TRACE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    header.count = static_cast<uint32_t>(count);
+    header.total = total;
+    if (!WriteAll(fd, &header, sizeof(header)))
+        return false;
+
+    if (count == 0)
+        return true;
+
+    //Oldest first: the tail of the array from the oldest slot, then the wrapped start, all but the newest
+    uint64_t first = (total - count) & mask;
+    uint64_t older = count - 1;
+    uint64_t tail = older < mask + 1 - first ? older : mask + 1 - first;
+    if (!WriteAll(fd, &records[first], tail * sizeof(TraceRecord)) ||
+        !WriteAll(fd, &records[0], (older - tail) * sizeof(TraceRecord)))
+        return false;
+
+    //The newest record's value is still pending while a machine is attached, take it from its registers
+    TraceRecord newest = records[(total - 1) & mask];
+    const uint8_t* registers = machineRegisters;
+    if (registers && pendingValue != &spare)
+        newest.value = registers[lastWritten & 0xF];
+    return WriteAll(fd, &newest, sizeof(newest));
+#else
+    (void)fd;
+    return false;
+#endif
+}
+
+bool TraceRing::Dump(const std::filesystem::path& filepath) const
+{
+#if CHIP8_TRACE_SIGNALS
+    int fd = open(filepath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool written = DumpTo(fd);
+    return close(fd) == 0 && written;
+#else
+    (void)filepath;
+    return false;
+#endif
+}
+
+bool TraceRing::InstallSignalHandlers(const std::filesystem::path& filepath)
+{
+#if CHIP8_TRACE_SIGNALS
+    std::string path = filepath.string();
+    if (path.size() >= sizeof(dumpPath))
+        return false;
+    std::memcpy(dumpPath, path.c_str(), path.size() + 1);
+    installedPath.store(dumpPath);
+    installedRing.store(this);
+
+    struct sigaction action{};
+    action.sa_handler = OnSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART; //SIGUSR1 must not fail the emulator's blocking calls
+    sigaction(SIGUSR1, &action, nullptr);
+    for (int signal : CRASH_SIGNALS)
+        sigaction(signal, &action, nullptr);
+    return true;
+#else
+    (void)filepath;
+    return false;
+#endif
+}
+
+void TraceRing::RemoveSignalHandlers()
+{
+#if CHIP8_TRACE_SIGNALS
+    if (installedRing.load() != this)
+        return;
+    std::signal(SIGUSR1, SIG_DFL);
+    for (int signal : CRASH_SIGNALS)
+        std::signal(signal, SIG_DFL);
+    installedRing.store(nullptr);
+    installedPath.store(nullptr);
+#endif
+}